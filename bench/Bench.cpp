@@ -0,0 +1,193 @@
+#include "MockCompositor.hpp"
+
+#include "../src/helpers/EventLoop.hpp"
+#include "../src/helpers/Logger.hpp"
+#include "../src/state/AppState.hpp"
+#include "../src/state/HyprlandIPC.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <print>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// End-to-end shutdown against a mock compositor, at a few session sizes.
+// Every scenario runs in its own process, as the state and the IPC paths are process-wide.
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto   SCENARIO_TIMEOUT = std::chrono::seconds(60);
+constexpr size_t RECONCILE_ROUNDS = 50;
+
+struct SScenario {
+    const char*  name;
+    SMockSession session;
+};
+
+struct SResult {
+    bool   ok          = false;
+    double initMs      = 0;
+    double reconcileUs = 0;
+    double exitMs      = 0;
+};
+
+static double millis(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static SResult runScenario(const SScenario& scenario) {
+    SResult result;
+
+    char    tmpl[] = "/tmp/hyprshutdown-bench-XXXXXX";
+    if (!mkdtemp(tmpl))
+        return result;
+
+    const std::string RUNTIME_DIR = tmpl;
+    const std::string SIGNATURE   = "mock_1_bench";
+
+    setenv("XDG_RUNTIME_DIR", RUNTIME_DIR.c_str(), 1);
+    setenv("HYPRLAND_INSTANCE_SIGNATURE", SIGNATURE.c_str(), 1);
+
+    CMockCompositor mock(scenario.session);
+
+    if (!mock.start(RUNTIME_DIR, SIGNATURE)) {
+        g_logger->log(LOG_ERR, "{}: couldn't start the mock compositor", scenario.name);
+        return result;
+    }
+
+    const auto STATE = State::state();
+    // the mock shares our cgroup, and so does everything else
+    STATE->m_useCgroups = false;
+    // like --daemon, so the registry can be measured before anything is closed
+    STATE->m_resident = true;
+
+    const auto INIT_BEGIN = Clock::now();
+
+    if (!STATE->init()) {
+        g_logger->log(LOG_ERR, "{}: init failed", scenario.name);
+        return result;
+    }
+
+    result.initMs = millis(Clock::now() - INIT_BEGIN);
+
+    // nothing was asked to close yet, so every app is still there
+    const auto RECONCILE_BEGIN = Clock::now();
+    for (size_t i = 0; i < RECONCILE_ROUNDS; ++i) {
+        STATE->updateState();
+    }
+    result.reconcileUs = millis(Clock::now() - RECONCILE_BEGIN) * 1000.0 / RECONCILE_ROUNDS;
+
+    bool                      exited = false;
+    SP<HyprlandIPC::CRequest> exitRequest;
+
+    // layers wait for the windows group, even while a window takes its time to close
+    bool layersEarly = false;
+
+    std::function<void()>     tick = [&] {
+        STATE->updateState();
+
+        const auto& APPS = STATE->apps();
+        if (std::ranges::any_of(APPS, [](const auto& a) { return a->m_group == Config::GROUP_WINDOWS; }) &&
+            std::ranges::any_of(APPS, [](const auto& a) { return a->m_group == Config::GROUP_LAYERS && a->m_stage != State::CApp::QUIT_NONE; }))
+            layersEarly = true;
+
+        if (!STATE->apps().empty()) {
+            g_loop->addTimer(std::chrono::milliseconds(10), [&] { tick(); });
+            return;
+        }
+
+        exitRequest = HyprlandIPC::request("/dispatch exit", [&](std::expected<std::string_view, std::string>&& ret) {
+            exited = ret && *ret == "ok";
+            g_loop->leaveLoop();
+        });
+    };
+
+    const auto TIMEOUT = g_loop->addTimer(SCENARIO_TIMEOUT, [] { g_loop->leaveLoop(); });
+
+    // init and the shutdown itself, without the rounds above
+    const auto SHUTDOWN_BEGIN = Clock::now();
+    STATE->beginShutdown();
+
+    tick();
+    g_loop->enterLoop();
+
+    result.exitMs = result.initMs + millis(Clock::now() - SHUTDOWN_BEGIN);
+    result.ok     = exited && !layersEarly;
+
+    if (!exited)
+        g_logger->log(LOG_ERR, "{}: didn't finish, {} apps left", scenario.name, STATE->apps().size());
+
+    if (layersEarly)
+        g_logger->log(LOG_ERR, "{}: layers were asked to quit while windows were still closing", scenario.name);
+
+    TIMEOUT->cancel();
+    mock.stop();
+
+    std::error_code ec;
+    std::filesystem::remove_all(RUNTIME_DIR, ec);
+
+    return result;
+}
+
+int main(int argc, char** argv) {
+    g_logger->setLogLevel(LOG_ERR);
+
+    // clang-format off
+    const std::vector<SScenario> SCENARIOS = {
+        {"10 windows",             {.windows = 10, .layers = 2, .children = 2}},
+        {"100 windows",            {.windows = 100, .layers = 4, .children = 8}},
+        {"1000 windows",           {.windows = 1000, .layers = 8, .children = 16}},
+        {"5000 windows",           {.windows = 5000, .layers = 8, .children = 32}},
+        {"100 windows, slow save", {.windows = 100, .layers = 4, .children = 8, .closeDelay = std::chrono::milliseconds(20), .slowEvery = 10,
+                                    .slowDelay = std::chrono::milliseconds(1000)}},
+    };
+    // clang-format on
+
+    bool ok = true;
+
+    std::println("{:<24} {:>10} {:>16} {:>16}", "scenario", "init (ms)", "reconcile (us)", "to exit (ms)");
+
+    for (const auto& scenario : SCENARIOS) {
+        int pipeFds[2];
+        if (pipe(pipeFds) < 0)
+            return 1;
+
+        const pid_t PID = fork();
+
+        if (PID < 0)
+            return 1;
+
+        if (PID == 0) {
+            close(pipeFds[0]);
+            const auto RESULT = runScenario(scenario);
+            if (write(pipeFds[1], &RESULT, sizeof(RESULT)) != sizeof(RESULT))
+                _exit(1);
+            _exit(RESULT.ok ? 0 : 1);
+        }
+
+        close(pipeFds[1]);
+
+        SResult result;
+        if (read(pipeFds[0], &result, sizeof(result)) != sizeof(result))
+            result.ok = false;
+        close(pipeFds[0]);
+
+        int status = 0;
+        waitpid(PID, &status, 0);
+
+        if (!result.ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::println("{:<24} failed", scenario.name);
+            ok = false;
+            continue;
+        }
+
+        std::println("{:<24} {:>10.2f} {:>16.2f} {:>16.2f}", scenario.name, result.initMs, result.reconcileUs, result.exitMs);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,420 @@
+#include "MockCompositor.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <ranges>
+#include <string_view>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <hyprutils/memory/Casts.hpp>
+
+using namespace Hyprutils::Memory;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct SWindow {
+        pid_t       pid = -1;
+        std::string clazz, title;
+        bool        closing = false;
+    };
+
+    struct SLayer {
+        uint64_t address = 0;
+        pid_t    pid     = -1;
+    };
+
+    [[noreturn]] void dummyMain() {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        while (true) {
+            pause();
+        }
+    }
+
+    // process standing in for an app, gone on SIGTERM
+    pid_t spawnDummy() {
+        const pid_t PID = fork();
+
+        if (PID == 0)
+            dummyMain();
+
+        return PID;
+    }
+
+    // same, but not our child, like apps launched through a launcher. Those are only closed through their windows.
+    pid_t spawnDetachedDummy() {
+        int fds[2];
+        if (pipe(fds) < 0)
+            return -1;
+
+        const pid_t PID = fork();
+
+        if (PID == 0) {
+            const pid_t GRANDCHILD = fork();
+            if (GRANDCHILD == 0)
+                dummyMain();
+
+            _exit(write(fds[1], &GRANDCHILD, sizeof(GRANDCHILD)) == sizeof(GRANDCHILD) ? 0 : 1);
+        }
+
+        pid_t grandchild = -1;
+        if (PID > 0) {
+            if (read(fds[0], &grandchild, sizeof(grandchild)) != sizeof(grandchild))
+                grandchild = -1;
+            waitpid(PID, nullptr, 0);
+        }
+
+        close(fds[0]);
+        close(fds[1]);
+
+        return grandchild;
+    }
+
+    Hyprutils::OS::CFileDescriptor listenOn(const std::string& path) {
+        auto fd = Hyprutils::OS::CFileDescriptor{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+
+        if (!fd.isValid())
+            return {};
+
+        sockaddr_un addr = {0};
+        addr.sun_family  = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        if (bind(fd.get(), rc<sockaddr*>(&addr), SUN_LEN(&addr)) < 0 || listen(fd.get(), 128) < 0)
+            return {};
+
+        return fd;
+    }
+
+    bool writeAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            const auto LEN = write(fd, data.data(), data.size());
+
+            if (LEN < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+
+            data.remove_prefix(LEN);
+        }
+
+        return true;
+    }
+
+    class CServer {
+      public:
+        CServer(const SMockSession& session, int requestSocket, int eventSocket) : m_session(session), m_requestSocket(requestSocket), m_eventSocket(eventSocket) {
+            const size_t PROCESSES = (session.windows + session.windowsPerProcess - 1) / std::max<size_t>(session.windowsPerProcess, 1);
+
+            std::vector<pid_t> owners;
+            for (size_t i = 0; i < PROCESSES; ++i) {
+                owners.emplace_back(spawnDetachedDummy());
+            }
+
+            for (size_t i = 0; i < session.windows; ++i) {
+                m_windows[0x5a0000 + (i * 0x100)] = SWindow{
+                    .pid   = owners[i / std::max<size_t>(session.windowsPerProcess, 1)],
+                    .clazz = std::format("mock.app{}", i / std::max<size_t>(session.windowsPerProcess, 1)),
+                    .title = std::format("Window {}, with a \"title\"", i),
+                };
+            }
+
+            for (size_t i = 0; i < session.layers; ++i) {
+                m_layers.emplace_back(SLayer{.address = 0x7f0000 + (i * 0x100), .pid = spawnDummy()});
+            }
+
+            for (size_t i = 0; i < session.children; ++i) {
+                spawnDummy();
+            }
+        }
+
+        [[noreturn]] void run() {
+            while (true) {
+                std::vector<pollfd> fds = {{.fd = m_requestSocket, .events = POLLIN}, {.fd = m_eventSocket, .events = POLLIN}};
+
+                int                 timeout = 100; // for reaping
+                if (!m_closing.empty())
+                    timeout = std::clamp<int>(std::chrono::duration_cast<std::chrono::milliseconds>(m_closing.begin()->first - Clock::now()).count(), 0, timeout);
+
+                poll(fds.data(), fds.size(), timeout);
+
+                for (pid_t pid = waitpid(-1, nullptr, WNOHANG); pid > 0; pid = waitpid(-1, nullptr, WNOHANG)) {
+                    onProcessExited(pid);
+                }
+
+                if (fds[1].revents & POLLIN) {
+                    const int FD = accept4(m_eventSocket, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (FD >= 0)
+                        m_subscribers.emplace_back(FD);
+                }
+
+                if (fds[0].revents & POLLIN) {
+                    const int FD = accept4(m_requestSocket, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (FD >= 0) {
+                        handleConnection(FD);
+                        close(FD);
+                    }
+                }
+
+                closeDueWindows();
+            }
+        }
+
+      private:
+        void handleConnection(int fd) {
+            std::string request;
+            char        buffer[8192];
+
+            // no framing, like Hyprland: read what arrives, and whatever follows shortly after.
+            // Our client shuts down its write side after the request, which ends this right away.
+            for (int timeout = 1000; true; timeout = 2) {
+                pollfd pfd = {.fd = fd, .events = POLLIN};
+                if (poll(&pfd, 1, timeout) <= 0)
+                    break;
+
+                const auto LEN = read(fd, buffer, sizeof(buffer));
+                if (LEN <= 0)
+                    break;
+
+                request.append(buffer, LEN);
+            }
+
+            std::string reply;
+
+            if (request.starts_with("[[BATCH]]")) {
+                for (const auto& cmd : std::views::split(std::string_view{request}.substr(9), ';')) {
+                    if (!reply.empty())
+                        reply += "\n\n\n";
+                    reply += handleRequest(std::string_view{cmd});
+                }
+            } else
+                reply = handleRequest(request);
+
+            writeAll(fd, reply);
+
+            if (m_exitRequested)
+                exitServer();
+        }
+
+        std::string handleRequest(std::string_view req) {
+            if (req == "j/status")
+                return R"({"version":"mock","configProvider":"hyprlang"})";
+
+            if (req == "j/clients")
+                return clientsJson();
+
+            if (req == "j/layers")
+                return layersJson();
+
+            if (req == "/dispatch exit") {
+                m_exitRequested = true;
+                return "ok";
+            }
+
+            if (req.starts_with("/dispatch closewindow address:")) {
+                uint64_t   address = 0;
+                const auto HEX     = req.substr(req.find("0x") + 2);
+                std::from_chars(HEX.data(), HEX.data() + HEX.size(), address, 16);
+
+                const auto IT = m_windows.find(address);
+                if (IT == m_windows.end())
+                    return "No such window";
+
+                if (!IT->second.closing) {
+                    const auto INDEX = (address - 0x5a0000) / 0x100;
+                    const bool SLOW  = m_session.slowEvery > 0 && INDEX % m_session.slowEvery == 0;
+
+                    IT->second.closing = true;
+                    m_closing.emplace(Clock::now() + (SLOW ? m_session.slowDelay : m_session.closeDelay), address);
+                }
+
+                return "ok";
+            }
+
+            return "unknown request";
+        }
+
+        std::string clientsJson() const {
+            std::string json = "[";
+
+            for (const auto& [address, w] : m_windows) {
+                // some of what Hyprland sends, which we skip
+                json += std::format(R"({{"address":"0x{:x}","mapped":true,"hidden":false,"at":[0,0],"size":[1280,720],"workspace":{{"id":1,"name":"1"}},)"
+                                    R"("floating":false,"monitor":0,"class":"{}","title":"{}","initialClass":"{}","pid":{},"xwayland":false,"tags":[]}},)",
+                                    address, w.clazz, escaped(w.title), w.clazz, w.pid);
+            }
+
+            if (json.size() > 1)
+                json.pop_back();
+
+            return json + "]";
+        }
+
+        std::string layersJson() const {
+            std::string json = R"({"MOCK-1":{"levels":{"0":[],"1":[],"2":[)";
+
+            for (const auto& l : m_layers) {
+                json += std::format(R"({{"address":"0x{:x}","x":0,"y":0,"w":1920,"h":30,"namespace":"mock-bar","pid":{}}},)", l.address, l.pid);
+            }
+
+            if (json.back() == ',')
+                json.pop_back();
+
+            return json + "],\"3\":[]}}}";
+        }
+
+        static std::string escaped(std::string_view str) {
+            std::string out;
+            for (const char c : str) {
+                if (c == '"' || c == '\\')
+                    out += '\\';
+                out += c;
+            }
+            return out;
+        }
+
+        void closeDueWindows() {
+            const auto NOW = Clock::now();
+
+            while (!m_closing.empty() && m_closing.begin()->first <= NOW) {
+                const auto ADDRESS = m_closing.begin()->second;
+                m_closing.erase(m_closing.begin());
+                m_windows.erase(ADDRESS);
+
+                broadcast(std::format("closewindow>>{:x}\n", ADDRESS));
+            }
+        }
+
+        // like a crashed app, its windows go away with it. Only seen for our own children.
+        void onProcessExited(pid_t pid) {
+            std::erase_if(m_windows, [this, pid](const auto& e) {
+                if (e.second.pid != pid)
+                    return false;
+
+                broadcast(std::format("closewindow>>{:x}\n", e.first));
+                return true;
+            });
+
+            std::erase_if(m_closing, [this](const auto& e) { return !m_windows.contains(e.second); });
+        }
+
+        void broadcast(const std::string& event) {
+            std::erase_if(m_subscribers, [&event](int fd) {
+                if (writeAll(fd, event))
+                    return false;
+
+                close(fd);
+                return true;
+            });
+        }
+
+        [[noreturn]] void exitServer() {
+            for (const auto& s : m_subscribers) {
+                close(s);
+            }
+
+            // take the session down with us
+            signal(SIGTERM, SIG_IGN);
+            ::kill(0, SIGTERM);
+
+            while (waitpid(-1, nullptr, 0) > 0) {
+                ;
+            }
+
+            _exit(0);
+        }
+
+        const SMockSession&                        m_session;
+        int                                        m_requestSocket = -1, m_eventSocket = -1;
+
+        std::map<uint64_t, SWindow>                m_windows;
+        std::vector<SLayer>                        m_layers;
+        std::multimap<Clock::time_point, uint64_t> m_closing;
+        std::vector<int>                           m_subscribers;
+        bool                                       m_exitRequested = false;
+    };
+}
+
+CMockCompositor::CMockCompositor(const SMockSession& session) : m_session(session) {
+    ;
+}
+
+CMockCompositor::~CMockCompositor() {
+    stop();
+}
+
+bool CMockCompositor::start(const std::string& runtimeDir, const std::string& signature) {
+    const auto      DIR = std::format("{}/hypr/{}", runtimeDir, signature);
+
+    std::error_code ec;
+    std::filesystem::create_directories(DIR, ec);
+    if (ec)
+        return false;
+
+    m_requestSocket = listenOn(DIR + "/.socket.sock");
+    m_eventSocket   = listenOn(DIR + "/.socket2.sock");
+
+    if (!m_requestSocket.isValid() || !m_eventSocket.isValid())
+        return false;
+
+    m_pid = fork();
+
+    if (m_pid < 0)
+        return false;
+
+    if (m_pid == 0)
+        serve();
+
+    // also done by the child, whoever comes first
+    setpgid(m_pid, m_pid);
+
+    // the sockets are the server's now
+    m_requestSocket.reset();
+    m_eventSocket.reset();
+
+    std::ofstream lock(DIR + "/hyprland.lock");
+    lock << m_pid << "\nwayland-mock\n";
+
+    return lock.good();
+}
+
+void CMockCompositor::serve() {
+    // own process group, so exit can take the dummies down with it
+    setpgid(0, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    CServer server(m_session, m_requestSocket.get(), m_eventSocket.get());
+    server.run();
+}
+
+void CMockCompositor::stop() {
+    if (m_pid <= 0)
+        return;
+
+    if (waitpid(m_pid, nullptr, WNOHANG) == 0) {
+        ::kill(-m_pid, SIGKILL);
+        waitpid(m_pid, nullptr, 0);
+    }
+
+    m_pid = -1;
+}
+
+pid_t CMockCompositor::pid() const {
+    return m_pid;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include <hyprutils/os/FileDescriptor.hpp>
+
+// A synthetic session, as seen through Hyprland's IPC
+struct SMockSession {
+    size_t                    windows = 0;
+    size_t                    layers  = 0;
+    // background processes, children of the compositor
+    size_t                    children = 0;
+
+    // windows are spread over processes like this, a process exits on SIGTERM.
+    // They aren't children of the compositor, so they are closed through their windows.
+    size_t                    windowsPerProcess = 8;
+
+    // how long a window takes to close after closewindow
+    std::chrono::milliseconds closeDelay = std::chrono::milliseconds(0);
+    // every slowEvery-th window takes slowDelay instead, like an app asking to save
+    size_t                    slowEvery = 0;
+    std::chrono::milliseconds slowDelay = std::chrono::milliseconds(0);
+};
+
+// Stands in for Hyprland: serves .socket.sock and .socket2.sock from a forked process.
+// Answers j/status, j/clients, j/layers, closewindow (also batched) and exit.
+class CMockCompositor {
+  public:
+    CMockCompositor(const SMockSession& session);
+    ~CMockCompositor();
+
+    CMockCompositor(const CMockCompositor&) = delete;
+    CMockCompositor(CMockCompositor&)       = delete;
+    CMockCompositor(CMockCompositor&&)      = delete;
+
+    // sets up runtimeDir/hypr/signature like Hyprland does and forks the server
+    bool  start(const std::string& runtimeDir, const std::string& signature);
+    // kills the server if it didn't exit yet
+    void  stop();
+
+    pid_t pid() const;
+
+  private:
+    [[noreturn]] void              serve();
+
+    SMockSession                   m_session;
+    Hyprutils::OS::CFileDescriptor m_requestSocket, m_eventSocket;
+    pid_t                          m_pid = -1;
+};
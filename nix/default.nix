@@ -7,6 +7,7 @@
   cairo,
   glaze,
   hyprgraphics,
+  hyprlang,
   hyprtoolkit,
   hyprutils,
   libdrm,
@@ -29,6 +30,7 @@ stdenv.mkDerivation {
     cairo
     (glaze.override { enableSSL = false; })
     hyprgraphics
+    hyprlang
     hyprtoolkit
     hyprutils
     libdrm
@@ -0,0 +1,136 @@
+#include "ConfigManager.hpp"
+#include "../helpers/Logger.hpp"
+
+#include <any>
+#include <filesystem>
+
+#include <hyprlang.hpp>
+
+using namespace Config;
+
+// rule values left at this inherit from general
+constexpr Hyprlang::INT UNSET = -2;
+
+static std::string defaultConfigPath() {
+    const auto XDG = getenv("XDG_CONFIG_HOME");
+    if (XDG && XDG[0] != '\0')
+        return std::string{XDG} + "/hypr/hyprshutdown.conf";
+
+    const auto HOME = getenv("HOME");
+    return std::string{HOME ? HOME : ""} + "/.config/hypr/hyprshutdown.conf";
+}
+
+static std::optional<std::chrono::milliseconds> toTimeout(Hyprlang::INT value) {
+    if (value < 0)
+        return std::nullopt;
+
+    return std::chrono::milliseconds(value);
+}
+
+static std::optional<eShutdownGroup> toGroup(std::string_view name) {
+    if (name == "windows")
+        return GROUP_WINDOWS;
+    if (name == "layers")
+        return GROUP_LAYERS;
+    if (name == "background")
+        return GROUP_BACKGROUND;
+
+    return std::nullopt;
+}
+
+bool CConfigManager::init(const std::optional<std::string>& path) {
+    const auto      PATH = path.value_or(defaultConfigPath());
+
+    std::error_code ec;
+    if (!std::filesystem::exists(PATH, ec)) {
+        if (path)
+            g_logger->log(LOG_ERR, "Config {} doesn't exist", PATH);
+        else
+            g_logger->log(LOG_DEBUG, "No config at {}, using defaults", PATH);
+        return !path;
+    }
+
+    Hyprlang::CConfig config(PATH.c_str(), Hyprlang::SConfigOptions{.throwAllErrors = false, .allowMissingConfig = true});
+
+    config.addConfigValue("general:term_timeout", Hyprlang::INT{-1});
+    config.addConfigValue("general:kill_timeout", Hyprlang::INT{-1});
+    config.addConfigValue("general:reclose_interval", Hyprlang::INT{4500});
+
+    config.addSpecialCategory("rule", Hyprlang::SSpecialCategoryOptions{.key = nullptr, .anonymousKeyBased = true});
+    config.addSpecialConfigValue("rule", "class", Hyprlang::STRING{""});
+    config.addSpecialConfigValue("rule", "term_timeout", Hyprlang::INT{UNSET});
+    config.addSpecialConfigValue("rule", "kill_timeout", Hyprlang::INT{UNSET});
+    config.addSpecialConfigValue("rule", "group", Hyprlang::STRING{""});
+
+    config.commence();
+
+    const auto RESULT = config.parse();
+
+    if (RESULT.error)
+        g_logger->log(LOG_ERR, "Config {} has errors: {}", PATH, RESULT.getError());
+
+    m_default.term    = toTimeout(std::any_cast<Hyprlang::INT>(config.getConfigValue("general:term_timeout")));
+    m_default.kill    = toTimeout(std::any_cast<Hyprlang::INT>(config.getConfigValue("general:kill_timeout")));
+    m_recloseInterval = std::chrono::milliseconds(std::max<Hyprlang::INT>(std::any_cast<Hyprlang::INT>(config.getConfigValue("general:reclose_interval")), 100));
+
+    m_rules.clear();
+    m_cache.clear();
+
+    for (const auto& key : config.listKeysForSpecialCategory("rule")) {
+        const std::string CLASS = std::any_cast<Hyprlang::STRING>(config.getSpecialConfigValue("rule", "class", key.c_str()));
+        const auto        TERM  = std::any_cast<Hyprlang::INT>(config.getSpecialConfigValue("rule", "term_timeout", key.c_str()));
+        const auto        KILL  = std::any_cast<Hyprlang::INT>(config.getSpecialConfigValue("rule", "kill_timeout", key.c_str()));
+        const std::string GROUP = std::any_cast<Hyprlang::STRING>(config.getSpecialConfigValue("rule", "group", key.c_str()));
+
+        if (CLASS.empty()) {
+            g_logger->log(LOG_ERR, "Config: a rule has no class, ignoring it");
+            continue;
+        }
+
+        const auto PARSED_GROUP = toGroup(GROUP);
+
+        if (!GROUP.empty() && !PARSED_GROUP)
+            g_logger->log(LOG_ERR, "Config: rule {} has an unknown group {}, ignoring the group", CLASS, GROUP);
+
+        try {
+            m_rules.emplace_back(SRule{
+                .clazz = std::regex{CLASS, std::regex::ECMAScript | std::regex::optimize},
+                .policy =
+                    SAppPolicy{
+                        .term  = TERM == UNSET ? m_default.term : toTimeout(TERM),
+                        .kill  = KILL == UNSET ? m_default.kill : toTimeout(KILL),
+                        .group = PARSED_GROUP,
+                    },
+            });
+        } catch (const std::regex_error& e) {
+            g_logger->log(LOG_ERR, "Config: rule class {} is not a valid regex: {}", CLASS, e.what());
+        }
+    }
+
+    g_logger->log(LOG_DEBUG, "Loaded config {} with {} rules", PATH, m_rules.size());
+
+    return !RESULT.error;
+}
+
+const SAppPolicy& CConfigManager::policyFor(std::string_view clazz) {
+    if (const auto IT = m_cache.find(clazz); IT != m_cache.end())
+        return *IT->second;
+
+    const SAppPolicy* policy = &m_default;
+
+    for (const auto& r : m_rules) {
+        if (!std::regex_search(clazz.begin(), clazz.end(), r.clazz))
+            continue;
+
+        policy = &r.policy;
+        break;
+    }
+
+    m_cache.emplace(std::string{clazz}, policy);
+
+    return *policy;
+}
+
+std::chrono::milliseconds CConfigManager::recloseInterval() const {
+    return m_recloseInterval;
+}
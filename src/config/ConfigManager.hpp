@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../helpers/Memory.hpp"
+#include "../helpers/StringPool.hpp"
+
+namespace Config {
+    // Apps are shut down group by group, the next one starts once everything in the previous one is gone.
+    enum eShutdownGroup : uint8_t {
+        GROUP_WINDOWS = 0,
+        GROUP_LAYERS,
+        GROUP_BACKGROUND,
+    };
+
+    // How long an app gets before each escalation. nullopt means never, and waiting for the user.
+    struct SAppPolicy {
+        // from the close request to SIGTERM
+        std::optional<std::chrono::milliseconds> term;
+        // from SIGTERM to SIGKILL
+        std::optional<std::chrono::milliseconds> kill;
+        // nullopt: by what the app is, a window, a layer or a background process
+        std::optional<eShutdownGroup> group;
+    };
+
+    // Reads $XDG_CONFIG_HOME/hypr/hyprshutdown.conf:
+    //
+    //   general {
+    //       term_timeout = -1       # ms, -1 for never
+    //       kill_timeout = -1
+    //       reclose_interval = 4500 # ms between re-sending close requests and SIGTERMs
+    //   }
+    //
+    //   rule {
+    //       class = ^(nm-applet|syncthing)$ # regex, the first matching rule wins
+    //       term_timeout = 0                # unset ones come from general
+    //       kill_timeout = 200
+    //       group = background              # windows, layers or background. Quit in that order.
+    //   }
+    class CConfigManager {
+      public:
+        CConfigManager()  = default;
+        ~CConfigManager() = default;
+
+        CConfigManager(const CConfigManager&) = delete;
+        CConfigManager(CConfigManager&)       = delete;
+        CConfigManager(CConfigManager&&)      = delete;
+
+        // a missing file is fine. Errors are logged, and whatever parsed is used.
+        bool                      init(const std::optional<std::string>& path = std::nullopt);
+
+        // rules are matched once per class, then cached
+        const SAppPolicy&         policyFor(std::string_view clazz);
+        std::chrono::milliseconds recloseInterval() const;
+
+      private:
+        struct SRule {
+            std::regex clazz;
+            SAppPolicy policy;
+        };
+
+        std::vector<SRule>                                                               m_rules;
+        SAppPolicy                                                                       m_default;
+        std::chrono::milliseconds                                                        m_recloseInterval = std::chrono::milliseconds(4500);
+
+        std::unordered_map<std::string, const SAppPolicy*, SStringHash, std::equal_to<>> m_cache;
+    };
+};
+
+inline UP<Config::CConfigManager> g_config = makeUnique<Config::CConfigManager>();
@@ -0,0 +1,84 @@
+#include "Cgroup.hpp"
+
+#include <charconv>
+#include <format>
+#include <filesystem>
+#include <fstream>
+
+constexpr const char* CGROUP2_MOUNT = "/sys/fs/cgroup";
+
+std::optional<std::string> Cgroup::of(int64_t pid) {
+#if defined(__linux__)
+    std::ifstream ifs(std::format("/proc/{}/cgroup", pid));
+    if (!ifs.good())
+        return std::nullopt;
+
+    // v2 is the "0::/path" entry
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (!line.starts_with("0::"))
+            continue;
+
+        auto            path = std::string{CGROUP2_MOUNT} + line.substr(3);
+
+        std::error_code ec;
+        if (!std::filesystem::exists(path + "/cgroup.procs", ec) || ec)
+            return std::nullopt;
+
+        return path;
+    }
+#endif
+
+    return std::nullopt;
+}
+
+std::vector<std::string> Cgroup::subtree(const std::string& path) {
+    std::vector<std::string> result = {path};
+
+    std::error_code          ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(path, std::filesystem::directory_options::skip_permission_denied, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_directory(ec) && !ec)
+            result.emplace_back(it->path().string());
+    }
+
+    return result;
+}
+
+std::vector<int64_t> Cgroup::procs(const std::string& path) {
+    std::vector<int64_t> result;
+
+    std::ifstream        ifs(path + "/cgroup.procs");
+    std::string          line;
+    while (std::getline(ifs, line)) {
+        int64_t pid          = 0;
+        const auto [ptr, ec] = std::from_chars(line.data(), line.data() + line.size(), pid);
+        if (ec == std::errc())
+            result.emplace_back(pid);
+    }
+
+    return result;
+}
+
+bool Cgroup::populated(const std::string& path) {
+    std::ifstream ifs(path + "/cgroup.events");
+    std::string   line;
+    while (std::getline(ifs, line)) {
+        if (line.starts_with("populated "))
+            return line != "populated 0";
+    }
+
+    // can't tell, assume something is still there
+    return true;
+}
+
+bool Cgroup::kill(const std::string& path) {
+    std::ofstream ofs(path + "/cgroup.kill");
+    if (!ofs.good())
+        return false;
+
+    ofs << "1";
+    ofs.flush();
+
+    return ofs.good();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// cgroup v2 helpers. Everything fails gracefully where there are no cgroups (BSDs, v1-only hosts).
+namespace Cgroup {
+    // absolute path of pid's cgroup under the cgroup2 mount
+    std::optional<std::string> of(int64_t pid);
+    // path itself and every cgroup below it
+    std::vector<std::string>   subtree(const std::string& path);
+    std::vector<int64_t>       procs(const std::string& path);
+    bool                       populated(const std::string& path);
+    // SIGKILLs everything in the cgroup and below at once. Needs linux 5.14+
+    bool                       kill(const std::string& path);
+};
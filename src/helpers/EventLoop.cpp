@@ -0,0 +1,188 @@
+#include "EventLoop.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// epoll data for the timerfd, watches start at 1
+constexpr uint64_t TIMER_WATCH_ID = 0;
+
+void CEventLoopTimer::cancel() {
+    m_cancelled = true;
+    m_cb        = nullptr;
+}
+
+bool CEventLoopTimer::cancelled() const {
+    return m_cancelled;
+}
+
+CEventLoop::CEventLoop() {
+    m_epoll   = Hyprutils::OS::CFileDescriptor{epoll_create1(EPOLL_CLOEXEC)};
+    m_timerFd = Hyprutils::OS::CFileDescriptor{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)};
+
+    epoll_event ev = {.events = EPOLLIN, .data = {.u64 = TIMER_WATCH_ID}};
+    epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, m_timerFd.get(), &ev);
+}
+
+bool CEventLoop::addFd(int fd, std::function<void()>&& cb, uint32_t events) {
+    const auto  ID = m_nextWatchId++;
+
+    epoll_event ev = {.events = events, .data = {.u64 = ID}};
+    if (epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, fd, &ev) < 0) {
+        g_logger->log(LOG_ERR, "CEventLoop: couldn't watch fd {}: {}", fd, strerror(errno));
+        return false;
+    }
+
+    m_watches[ID]  = makeShared<SWatch>(fd, std::move(cb));
+    m_watchIds[fd] = ID;
+
+    return true;
+}
+
+void CEventLoop::modifyFd(int fd, uint32_t events) {
+    const auto IT = m_watchIds.find(fd);
+    if (IT == m_watchIds.end())
+        return;
+
+    epoll_event ev = {.events = events, .data = {.u64 = IT->second}};
+    epoll_ctl(m_epoll.get(), EPOLL_CTL_MOD, fd, &ev);
+}
+
+void CEventLoop::removeFd(int fd) {
+    const auto IT = m_watchIds.find(fd);
+    if (IT == m_watchIds.end())
+        return;
+
+    epoll_ctl(m_epoll.get(), EPOLL_CTL_DEL, fd, nullptr);
+
+    // if we are inside this watch's callback, dispatch still holds a ref
+    m_watches.erase(IT->second);
+    m_watchIds.erase(IT);
+}
+
+SP<CEventLoopTimer> CEventLoop::addTimer(std::chrono::steady_clock::duration timeout, std::function<void()>&& cb) {
+    auto timer        = makeShared<CEventLoopTimer>();
+    timer->m_deadline = std::chrono::steady_clock::now() + timeout;
+    timer->m_cb       = std::move(cb);
+
+    m_timers.emplace_back(timer);
+
+    armTimerFd();
+
+    return timer;
+}
+
+int CEventLoop::fd() const {
+    return m_epoll.get();
+}
+
+void CEventLoop::dispatch() {
+    dispatchWithTimeout(0);
+}
+
+void CEventLoop::enterLoop() {
+    m_running = true;
+
+    while (m_running) {
+        dispatchWithTimeout(-1);
+    }
+}
+
+void CEventLoop::leaveLoop() {
+    m_running = false;
+}
+
+void CEventLoop::dispatchWithTimeout(int timeoutMs) {
+    std::array<epoll_event, 64> events;
+    int                         count = 0;
+
+    do {
+        count = epoll_wait(m_epoll.get(), events.data(), events.size(), timeoutMs);
+
+        if (count < 0) {
+            if (errno != EINTR)
+                g_logger->log(LOG_ERR, "CEventLoop: epoll_wait failed: {}", strerror(errno));
+            return;
+        }
+
+        timeoutMs = 0;
+
+        for (int i = 0; i < count; ++i) {
+            const auto ID = events[i].data.u64;
+
+            if (ID == TIMER_WATCH_ID) {
+                uint64_t expirations = 0;
+                if (read(m_timerFd.get(), &expirations, sizeof(expirations)) < 0) {
+                    // re-armed for later by an earlier callback, nothing is due
+                    if (errno == EAGAIN)
+                        continue;
+
+                    if (errno != EINTR)
+                        g_logger->log(LOG_ERR, "CEventLoop: reading the timerfd failed: {}", strerror(errno));
+                }
+
+                dispatchTimers();
+                continue;
+            }
+
+            const auto IT = m_watches.find(ID);
+            if (IT == m_watches.end())
+                continue; // removed by an earlier callback
+
+            const auto WATCH = IT->second;
+            WATCH->cb();
+        }
+    } while (count == sc<int>(events.size()));
+}
+
+void CEventLoop::dispatchTimers() {
+    const auto                       NOW = std::chrono::steady_clock::now();
+
+    std::vector<SP<CEventLoopTimer>> due;
+
+    std::erase_if(m_timers, [&due, &NOW](const auto& t) {
+        if (t->m_cancelled)
+            return true;
+
+        if (t->m_deadline > NOW)
+            return false;
+
+        due.emplace_back(t);
+        return true;
+    });
+
+    // callbacks can add or cancel timers
+    for (const auto& t : due) {
+        if (t->m_cancelled)
+            continue;
+
+        auto cb = std::move(t->m_cb);
+        t->cancel();
+
+        if (cb)
+            cb();
+    }
+
+    armTimerFd();
+}
+
+void CEventLoop::armTimerFd() {
+    itimerspec spec = {};
+
+    const auto NEXT = std::ranges::min_element(m_timers, {}, [](const auto& t) { return t->m_cancelled ? std::chrono::steady_clock::time_point::max() : t->m_deadline; });
+
+    if (NEXT != m_timers.end() && !(*NEXT)->m_cancelled) {
+        const auto NS = std::chrono::duration_cast<std::chrono::nanoseconds>((*NEXT)->m_deadline.time_since_epoch()).count();
+
+        // a zero value would disarm it, so anything overdue fires asap
+        spec.it_value.tv_sec  = std::max<int64_t>(NS, 1) / 1000000000;
+        spec.it_value.tv_nsec = std::max<int64_t>(NS, 1) % 1000000000;
+    }
+
+    timerfd_settime(m_timerFd.get(), TFD_TIMER_ABSTIME, &spec, nullptr);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include <hyprutils/os/FileDescriptor.hpp>
+
+#include "Memory.hpp"
+
+class CEventLoopTimer {
+  public:
+    void cancel();
+    bool cancelled() const;
+
+  private:
+    std::chrono::steady_clock::time_point m_deadline;
+    std::function<void()>                 m_cb;
+    bool                                  m_cancelled = false;
+
+    friend class CEventLoop;
+};
+
+// Small epoll loop for everything that isn't UI: compositor IPC, pidfds, deadlines.
+// Its fd can be handed to another loop (hyprtoolkit's), which then calls dispatch().
+class CEventLoop {
+  public:
+    CEventLoop();
+    ~CEventLoop() = default;
+
+    CEventLoop(const CEventLoop&) = delete;
+    CEventLoop(CEventLoop&)       = delete;
+    CEventLoop(CEventLoop&&)      = delete;
+
+    // cb is called whenever fd has any of events pending. Level triggered.
+    bool                 addFd(int fd, std::function<void()>&& cb, uint32_t events = EPOLLIN);
+    void                 modifyFd(int fd, uint32_t events);
+    void                 removeFd(int fd);
+
+    SP<CEventLoopTimer>  addTimer(std::chrono::steady_clock::duration timeout, std::function<void()>&& cb);
+
+    // readable when dispatch() has work
+    int                  fd() const;
+    // handles everything pending without blocking
+    void                 dispatch();
+    // blocks and dispatches until leaveLoop()
+    void                 enterLoop();
+    void                 leaveLoop();
+
+  private:
+    struct SWatch {
+        int                   fd = -1;
+        std::function<void()> cb;
+    };
+
+    void                                     dispatchWithTimeout(int timeoutMs);
+    void                                     dispatchTimers();
+    void                                     armTimerFd();
+
+    Hyprutils::OS::CFileDescriptor           m_epoll;
+    Hyprutils::OS::CFileDescriptor           m_timerFd;
+
+    std::unordered_map<uint64_t, SP<SWatch>> m_watches;
+    std::unordered_map<int, uint64_t>        m_watchIds;
+    uint64_t                                 m_nextWatchId = 1;
+
+    std::vector<SP<CEventLoopTimer>>         m_timers;
+
+    bool                                     m_running = false;
+};
+
+inline UP<CEventLoop> g_loop = makeUnique<CEventLoop>();
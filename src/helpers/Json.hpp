@@ -0,0 +1,26 @@
+#pragma once
+
+#include <format>
+#include <string>
+#include <string_view>
+
+#include "Memory.hpp"
+
+namespace Json {
+    // appends str as the contents of a JSON string, without the quotes
+    inline void appendEscaped(std::string& out, std::string_view str) {
+        for (const char c : str) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (sc<unsigned char>(c) < 0x20)
+                        out += std::format("\\u{:04x}", sc<unsigned char>(c));
+                    else
+                        out += c;
+            }
+        }
+    }
+};
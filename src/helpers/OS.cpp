@@ -1,10 +1,23 @@
 #include "OS.hpp"
 
-#include <filesystem>
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 
-#include <hyprutils/string/String.hpp>
 #include <hyprutils/memory/Casts.hpp>
+#include <hyprutils/utils/ScopeGuard.hpp>
+
+using namespace Hyprutils::Memory;
 
 #if defined(__DragonFly__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include <sys/sysctl.h>
@@ -22,124 +35,222 @@
 #define KINFO_PROC struct kinfo_proc
 #endif
 #if defined(__DragonFly__)
+#define KP_PID(kp)  kp.kp_pid
 #define KP_PPID(kp) kp.kp_ppid
+#define KP_COMM(kp) kp.kp_comm
 #elif defined(__FreeBSD__)
+#define KP_PID(kp)  kp.ki_pid
 #define KP_PPID(kp) kp.ki_ppid
+#define KP_COMM(kp) kp.ki_comm
 #else
+#define KP_PID(kp)  kp.p_pid
 #define KP_PPID(kp) kp.p_ppid
+#define KP_COMM(kp) kp.p_comm
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+#define KERN_PROC_ALL KERN_PROC_PROC
 #endif
 #endif
 
-static std::optional<std::string> linuxExtractFromStatus(std::ifstream& ifs, const std::string_view& what) {
-    std::string line;
-    std::string full = std::string{what} + ":";
-    while (std::getline(ifs, line)) {
-        if (!line.starts_with(full))
-            continue;
+std::string_view OS::SProcess::name() const {
+    return std::string_view{comm.data(), strnlen(comm.data(), comm.size())};
+}
 
-        return Hyprutils::String::trim(line.substr(full.size()));
-    }
+#if !defined(KERN_PROC_PID)
+// "pid (comm) S ppid ...", comm can contain anything, including ')'
+static bool parseStat(std::string_view data, OS::SProcess& proc) {
+    const auto OPEN  = data.find('(');
+    const auto CLOSE = data.rfind(')');
 
-    return std::nullopt;
+    if (OPEN == std::string_view::npos || CLOSE == std::string_view::npos || CLOSE < OPEN || CLOSE + 4 >= data.size())
+        return false;
+
+    const auto COMM = data.substr(OPEN + 1, CLOSE - OPEN - 1);
+    std::memcpy(proc.comm.data(), COMM.data(), std::min(COMM.size(), proc.comm.size() - 1));
+    proc.comm[std::min(COMM.size(), proc.comm.size() - 1)] = '\0';
+
+    proc.state = data[CLOSE + 2];
+
+    const auto PPID      = data.substr(CLOSE + 4);
+    const auto [ptr, ec] = std::from_chars(PPID.data(), PPID.data() + PPID.size(), proc.ppid);
+
+    return ec == std::errc();
 }
 
-std::string OS::appNameForPid(int64_t pid) {
-#if defined(KERN_PROC_PID)
-    int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, Hyprutils::Memory::sc<int>(pid)};
-    KINFO_PROC kp;
-    size_t len = sizeof(kp);
+static void readStats(int procFd, std::span<const int64_t> pids, std::span<OS::SProcess> out) {
+    // pid, comm, state and ppid are all in the first few dozen bytes
+    char buffer[256];
+    char path[32];
 
-    if (sysctl(mib, 4, &kp, &len, nullptr, 0) == -1)
-        return "";
-    if (len == 0)
-        return "";
+    for (size_t i = 0; i < pids.size(); ++i) {
+        auto& proc = out[i];
+        proc.pid   = -1;
 
-#if defined(__FreeBSD__) || defined(__DragonFly__)
-    return kp.ki_comm;
-#elif defined(__NetBSD__) || defined(__OpenBSD__)
-    return kp.p_comm;
-#endif
-#else
-    std::string   dir = "/proc/" + std::to_string(pid) + "/status";
-    std::ifstream ifs(dir);
-    if (!ifs.good())
-        return "";
+        auto [end, ec] = std::to_chars(path, path + sizeof(path) - 6, pids[i]);
+        if (ec != std::errc())
+            continue;
+        std::memcpy(end, "/stat", 6);
 
-    auto data = linuxExtractFromStatus(ifs, "Name");
+        const int FD = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+        if (FD < 0)
+            continue; // gone already
 
-    return data.value_or("");
-#endif
+        const auto LEN = read(FD, buffer, sizeof(buffer));
+        close(FD);
+
+        if (LEN <= 0 || !parseStat({buffer, sc<size_t>(LEN)}, proc))
+            continue;
+
+        proc.pid = pids[i];
+    }
 }
+#endif
 
-std::vector<int64_t> OS::getAllPids() {
-    std::vector<int64_t> pids;
+bool OS::CProcessTable::snapshot(size_t threads) {
+    m_pids.clear();
+    m_procs.clear();
+    m_byPid.clear();
 
 #if defined(KERN_PROC_PID)
-    int                     mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PROC, 0};
-    size_t                  len    = 0;
-    std::vector<kinfo_proc> procs;
+    int mib[] = {
+        CTL_KERN,           KERN_PROC, KERN_PROC_ALL, 0,
+#if defined(__NetBSD__) || defined(__OpenBSD__)
+        sizeof(KINFO_PROC), 0,
+#endif
+    };
+    u_int  miblen = sizeof(mib) / sizeof(mib[0]);
+    size_t len    = 0;
+
+    if (sysctl(mib, miblen, nullptr, &len, nullptr, 0) == -1)
+        return false;
+
+    std::vector<KINFO_PROC> procs(len / sizeof(KINFO_PROC) + 16);
+    len = procs.size() * sizeof(KINFO_PROC);
 
-    if (sysctl(mib, 4, nullptr, &len, nullptr, 0) == -1)
-        return {};
+#if defined(__NetBSD__) || defined(__OpenBSD__)
+    mib[5] = procs.size();
+#endif
 
-    procs.resize(len / sizeof(kinfo_proc));
+    if (sysctl(mib, miblen, procs.data(), &len, nullptr, 0) == -1)
+        return false;
 
-    if (sysctl(mib, 4, procs.data(), &len, nullptr, 0) == -1)
-        return {};
+    procs.resize(len / sizeof(KINFO_PROC));
 
-    pids.reserve(procs.size());
-    for (const auto& p : procs) {
-        pids.emplace_back(p.ki_pid);
+    m_procs.reserve(procs.size());
+    for (const auto& kp : procs) {
+        auto& proc = m_procs.emplace_back();
+        proc.pid   = KP_PID(kp);
+        proc.ppid  = KP_PPID(kp);
+        strlcpy(proc.comm.data(), KP_COMM(kp), proc.comm.size());
     }
 #else
-    std::error_code ec;
+    const int PROCFD = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (PROCFD < 0)
+        return false;
+
+    auto procGuard = Hyprutils::Utils::CScopeGuard([PROCFD] { close(PROCFD); });
+
+    // raw getdents, numeric entries are processes
+    alignas(dirent64) char dents[32768];
+    while (true) {
+        const auto LEN = getdents64(PROCFD, dents, sizeof(dents));
+        if (LEN <= 0)
+            break;
 
-    if (std::filesystem::exists("/proc/self", ec) && !ec) {
-        for (const std::filesystem::path& p : std::filesystem::directory_iterator("/proc/", ec)) {
-            if (!std::filesystem::exists(p, ec) || ec)
+        for (ssize_t off = 0; off < LEN;) {
+            const auto ENT = rc<dirent64*>(dents + off);
+            off += ENT->d_reclen;
+
+            if (ENT->d_type != DT_DIR || ENT->d_name[0] < '1' || ENT->d_name[0] > '9')
                 continue;
 
-            if (!Hyprutils::String::isNumber(p.stem().string()))
+            int64_t    pid       = 0;
+            const auto NAMELEN   = strlen(ENT->d_name);
+            const auto [ptr, ec] = std::from_chars(ENT->d_name, ENT->d_name + NAMELEN, pid);
+            if (ec != std::errc() || ptr != ENT->d_name + NAMELEN)
                 continue;
 
-            try {
-                pids.emplace_back(std::stoll(p.stem()));
-            } catch (...) { ; }
+            m_pids.emplace_back(pid);
+        }
+    }
+
+    m_procs.resize(m_pids.size());
+
+    // below a few thousand pids, spawning threads costs more than it saves
+    threads = std::clamp<size_t>(std::min(threads, m_pids.size() / 1024), 1, 16);
+
+    if (threads == 1)
+        readStats(PROCFD, m_pids, m_procs);
+    else {
+        const size_t             PER_THREAD = (m_pids.size() + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (size_t begin = 0; begin < m_pids.size(); begin += PER_THREAD) {
+            const auto COUNT = std::min(PER_THREAD, m_pids.size() - begin);
+            workers.emplace_back(readStats, PROCFD, std::span<const int64_t>{m_pids}.subspan(begin, COUNT), std::span<SProcess>{m_procs}.subspan(begin, COUNT));
+        }
+
+        for (auto& w : workers) {
+            w.join();
         }
     }
+
+    std::erase_if(m_procs, [](const auto& p) { return p.pid < 0; });
 #endif
 
-    return pids;
+    std::ranges::sort(m_procs, [](const auto& a, const auto& b) { return a.ppid != b.ppid ? a.ppid < b.ppid : a.pid < b.pid; });
+
+    m_byPid.resize(m_procs.size());
+    for (uint32_t i = 0; i < m_byPid.size(); ++i) {
+        m_byPid[i] = i;
+    }
+    std::ranges::sort(m_byPid, {}, [this](uint32_t i) { return m_procs[i].pid; });
+
+    return true;
 }
 
-int64_t OS::ppidOf(int64_t pid) {
-#if defined(KERN_PROC_PID)
-    int mib[] = {
-        CTL_KERN,           KERN_PROC, KERN_PROC_PID, (int)pid,
-#if defined(__NetBSD__) || defined(__OpenBSD__)
-        sizeof(KINFO_PROC), 1,
-#endif
-    };
-    u_int      miblen = sizeof(mib) / sizeof(mib[0]);
-    KINFO_PROC kp;
-    size_t     sz = sizeof(KINFO_PROC);
-    if (sysctl(mib, miblen, &kp, &sz, nullptr, 0) != -1)
-        return KP_PPID(kp);
-#else
-    std::string   dir = "/proc/" + std::to_string(pid) + "/status";
-    std::ifstream ifs(dir);
-    if (!ifs.good())
-        return -1;
+const OS::SProcess* OS::CProcessTable::find(int64_t pid) const {
+    const auto IT = std::ranges::lower_bound(m_byPid, pid, {}, [this](uint32_t i) { return m_procs[i].pid; });
 
-    auto data = linuxExtractFromStatus(ifs, "PPid");
+    if (IT == m_byPid.end() || m_procs[*IT].pid != pid)
+        return nullptr;
 
-    if (!data)
-        return -1;
+    return &m_procs[*IT];
+}
 
-    try {
-        return std::stoll(*data);
-    } catch (std::exception& e) { ; }
-#endif
+std::span<const OS::SProcess> OS::CProcessTable::childrenOf(int64_t ppid) const {
+    const auto RANGE = std::ranges::equal_range(m_procs, ppid, {}, &SProcess::ppid);
+    return {RANGE.begin(), RANGE.end()};
+}
 
+std::span<const OS::SProcess> OS::CProcessTable::processes() const {
+    return m_procs;
+}
+
+int OS::pidfdOpen(int64_t pid) {
+#if defined(SYS_pidfd_open)
+    return syscall(SYS_pidfd_open, sc<pid_t>(pid), 0);
+#else
+    errno = ENOSYS;
     return -1;
+#endif
+}
+
+bool OS::pidfdSendSignal(int pidfd, int sig) {
+#if defined(SYS_pidfd_send_signal)
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0) == 0;
+#else
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+bool OS::processMrelease(int pidfd) {
+#if defined(SYS_process_mrelease)
+    return syscall(SYS_process_mrelease, pidfd, 0) == 0;
+#else
+    errno = ENOSYS;
+    return false;
+#endif
 }
@@ -3,9 +3,39 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <array>
+#include <span>
 
 namespace OS {
-    std::vector<int64_t> getAllPids();
-    std::string          appNameForPid(int64_t pid);
-    int64_t              ppidOf(int64_t pid);
-};
\ No newline at end of file
+    struct SProcess {
+        int64_t              pid   = -1;
+        int64_t              ppid  = -1;
+        char                 state = '?';
+        std::array<char, 64> comm  = {0};
+
+        std::string_view     name() const;
+    };
+
+    // A snapshot of the process table. Keep it around and re-snapshot, buffers are reused.
+    class CProcessTable {
+      public:
+        // shards the /proc reads across up to threads threads
+        bool                      snapshot(size_t threads = 1);
+
+        const SProcess*           find(int64_t pid) const;
+        std::span<const SProcess> childrenOf(int64_t ppid) const;
+        std::span<const SProcess> processes() const;
+
+      private:
+        std::vector<int64_t>  m_pids;
+        std::vector<SProcess> m_procs; // sorted by ppid, then pid
+        std::vector<uint32_t> m_byPid; // indices into m_procs, sorted by pid
+    };
+
+    // pidfd wrappers, return -1 / false where pidfds aren't supported
+    int  pidfdOpen(int64_t pid);
+    bool pidfdSendSignal(int pidfd, int sig);
+    // frees the memory of a SIGKILLed process right away, instead of whenever its exit gets to it. Needs linux 5.15+
+    bool processMrelease(int pidfd);
+};
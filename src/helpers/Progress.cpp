@@ -0,0 +1,75 @@
+#include "Progress.hpp"
+#include "Json.hpp"
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <format>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+bool CProgress::open(int fd) {
+    if (fd < 0 || fcntl(fd, F_GETFD) < 0) {
+        g_logger->log(LOG_ERR, "Can't write progress to fd {}: {}", fd, strerror(errno));
+        return false;
+    }
+
+    // a supervisor going away shouldn't take the shutdown with it
+    signal(SIGPIPE, SIG_IGN);
+
+    m_enabled = true;
+    m_fd      = fd;
+    m_started = Clock::now();
+
+    return true;
+}
+
+void CProgress::event(std::string_view name, std::initializer_list<Arg> args) {
+    if (!m_enabled)
+        return;
+
+    m_line = std::format("{{\"ms\":{},\"event\":\"", std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_started).count());
+    Json::appendEscaped(m_line, name);
+    m_line += '"';
+
+    if (!m_instance.empty()) {
+        m_line += ",\"instance\":\"";
+        Json::appendEscaped(m_line, m_instance);
+        m_line += '"';
+    }
+
+    for (const auto& [key, value] : args) {
+        m_line += ",\"";
+        Json::appendEscaped(m_line, key);
+        m_line += "\":";
+
+        if (std::holds_alternative<int64_t>(value))
+            m_line += std::to_string(std::get<int64_t>(value));
+        else {
+            m_line += '"';
+            Json::appendEscaped(m_line, std::get<std::string_view>(value));
+            m_line += '"';
+        }
+    }
+
+    m_line += "}\n";
+
+    // one write per line, so lines from --all-instances workers don't interleave
+    std::string_view rest = m_line;
+    while (!rest.empty()) {
+        const auto LEN = write(m_fd, rest.data(), rest.size());
+
+        if (LEN < 0 && errno == EINTR)
+            continue;
+
+        if (LEN < 0) {
+            g_logger->log(LOG_WARN, "Can't write progress anymore, stopping: {}", strerror(errno));
+            m_enabled = false;
+            return;
+        }
+
+        rest.remove_prefix(LEN);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "Memory.hpp"
+
+// Newline-delimited JSON events about the shutdown, for session supervisors (--progress-fd, --json-progress).
+// Every line is one object: {"ms":elapsed,"event":name,...args}. Everything is a no-op until open() is called.
+class CProgress {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Arg   = std::pair<std::string_view, std::variant<int64_t, std::string_view>>;
+
+    CProgress()  = default;
+    ~CProgress() = default;
+
+    CProgress(const CProgress&) = delete;
+    CProgress(CProgress&)       = delete;
+    CProgress(CProgress&&)      = delete;
+
+    // fd stays the caller's
+    bool open(int fd);
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    void event(std::string_view name, std::initializer_list<Arg> args = {});
+
+    // with --all-instances, added to every event
+    std::string m_instance;
+
+  private:
+    bool              m_enabled = false;
+    int               m_fd      = -1;
+    Clock::time_point m_started;
+    std::string       m_line;
+};
+
+inline UP<CProgress> g_progress = makeUnique<CProgress>();
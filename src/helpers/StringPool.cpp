@@ -0,0 +1,31 @@
+#include "StringPool.hpp"
+
+constexpr size_t CHUNK_SIZE = 16384;
+// bigger ones get a chunk to themselves, so a long string doesn't waste most of a chunk
+constexpr size_t MAX_SHARED = CHUNK_SIZE / 8;
+
+std::string_view CStringPool::intern(std::string_view str) {
+    if (str.empty())
+        return {};
+
+    if (const auto IT = m_strings.find(str); IT != m_strings.end())
+        return *IT;
+
+    if (str.size() > MAX_SHARED)
+        return *m_strings.emplace(m_large.emplace_back(str)).first;
+
+    if (m_chunks.empty() || m_chunks.back().capacity() - m_chunks.back().size() < str.size()) {
+        m_chunks.emplace_back();
+        m_chunks.back().reserve(CHUNK_SIZE);
+    }
+
+    auto&      chunk = m_chunks.back();
+    const auto OFF   = chunk.size();
+    chunk.append(str);
+
+    return *m_strings.emplace(std::string_view{chunk}.substr(OFF, str.size())).first;
+}
+
+size_t CStringPool::size() const {
+    return m_strings.size();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// for maps keyed by std::string that are looked up with views, together with std::equal_to<>
+struct SStringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view str) const {
+        return std::hash<std::string_view>{}(str);
+    }
+};
+
+// Deduplicated strings, packed into a few large chunks. Views from intern() stay valid for the pool's lifetime,
+// nothing is ever freed or moved before that. For the registry, where classes and cgroups repeat a lot.
+class CStringPool {
+  public:
+    CStringPool()  = default;
+    ~CStringPool() = default;
+
+    CStringPool(const CStringPool&) = delete;
+    CStringPool(CStringPool&)       = delete;
+    CStringPool(CStringPool&&)      = delete;
+
+    std::string_view intern(std::string_view str);
+    // distinct strings
+    size_t           size() const;
+
+  private:
+    // never grown past their reserved capacity, so their data doesn't move. Moving the strings themselves keeps it.
+    std::vector<std::string>             m_chunks;
+    // too big to share a chunk, always on the heap too
+    std::vector<std::string>             m_large;
+    std::unordered_set<std::string_view> m_strings;
+};
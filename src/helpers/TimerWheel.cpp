@@ -0,0 +1,121 @@
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+
+CTimerWheel::CTimerWheel(std::chrono::milliseconds tick, size_t slots) : m_tick(std::max(tick, std::chrono::milliseconds(1))), m_slots(std::max<size_t>(slots, 1)) {
+    ;
+}
+
+CTimerWheel::~CTimerWheel() {
+    if (m_timer)
+        m_timer->cancel();
+}
+
+uint64_t CTimerWheel::schedule(std::chrono::milliseconds timeout, std::function<void()>&& cb) {
+    const auto NOW = Clock::now();
+
+    // nothing to catch up on after being idle
+    if (m_pending == 0)
+        m_cursor = std::max(m_cursor, tickOf(NOW));
+
+    const auto DEADLINE = NOW + std::max(timeout, std::chrono::milliseconds(0));
+    // never into a tick that was already processed
+    const auto TICK = std::max(tickOf(DEADLINE), m_cursor);
+
+    const auto HANDLE = m_nextHandle++;
+    const auto SLOT   = TICK % m_slots.size();
+    m_slots[SLOT].emplace_back(SEntry{.handle = HANDLE, .deadline = DEADLINE, .cb = std::move(cb)});
+    m_slotOf.emplace(HANDLE, SLOT);
+    m_pending++;
+
+    arm();
+
+    return HANDLE;
+}
+
+void CTimerWheel::cancel(uint64_t handle) {
+    if (handle == 0)
+        return;
+
+    const auto SLOT = m_slotOf.find(handle);
+    if (SLOT == m_slotOf.end())
+        return; // fired or cancelled already
+
+    auto&      slot = m_slots[SLOT->second];
+    const auto IT   = std::ranges::find(slot, handle, &SEntry::handle);
+
+    if (IT != slot.end()) {
+        slot.erase(IT);
+        m_pending--;
+    }
+
+    m_slotOf.erase(SLOT);
+}
+
+size_t CTimerWheel::pending() const {
+    return m_pending;
+}
+
+uint64_t CTimerWheel::tickOf(Clock::time_point at) const {
+    return sc<uint64_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(at - m_epoch).count(), 0)) / m_tick.count();
+}
+
+void CTimerWheel::onTick() {
+    m_timer.reset();
+    m_armedTick.reset();
+
+    const auto                         NOW     = Clock::now();
+    // ticks before this one are over
+    const auto                         CURRENT = tickOf(NOW);
+
+    std::vector<std::function<void()>> due;
+
+    // a whole turn covers every slot, no need to go around more than once
+    for (uint64_t tick = std::max(m_cursor, CURRENT >= m_slots.size() ? CURRENT - m_slots.size() : 0); tick < CURRENT; ++tick) {
+        std::erase_if(m_slots[tick % m_slots.size()], [this, &due, &NOW](auto& e) {
+            if (e.deadline > NOW)
+                return false; // a later turn of the wheel
+
+            due.emplace_back(std::move(e.cb));
+            m_slotOf.erase(e.handle);
+            return true;
+        });
+    }
+
+    m_cursor = std::max(m_cursor, CURRENT);
+    m_pending -= due.size();
+
+    // callbacks can schedule and cancel
+    for (auto& cb : due) {
+        cb();
+    }
+
+    arm();
+}
+
+void CTimerWheel::arm() {
+    if (m_pending == 0) {
+        if (m_timer)
+            m_timer->cancel();
+        m_timer.reset();
+        m_armedTick.reset();
+        return;
+    }
+
+    // wake up once the next tick with anything in it is over. Its entries might be for a later turn, then we just go around.
+    uint64_t next = m_cursor;
+    while (m_slots[next % m_slots.size()].empty()) {
+        ++next;
+    }
+
+    // a new entry can come before what the timer is set for
+    if (m_timer && m_armedTick && *m_armedTick <= next)
+        return;
+
+    if (m_timer)
+        m_timer->cancel();
+
+    const auto AT = m_epoch + (m_tick * sc<int64_t>(next + 1));
+    m_timer       = g_loop->addTimer(AT - Clock::now(), [this] { onTick(); });
+    m_armedTick   = next;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.hpp"
+#include "Memory.hpp"
+
+// Hashed timer wheel on g_loop, for lots of deadlines that mostly get cancelled (one or two per app).
+// Scheduling and cancelling are O(1) (cancel searches one slot), deadlines fire up to one tick late.
+class CTimerWheel {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    CTimerWheel(std::chrono::milliseconds tick, size_t slots);
+    ~CTimerWheel();
+
+    CTimerWheel(const CTimerWheel&) = delete;
+    CTimerWheel(CTimerWheel&)       = delete;
+    CTimerWheel(CTimerWheel&&)      = delete;
+
+    // returns a handle for cancel(), never 0
+    uint64_t schedule(std::chrono::milliseconds timeout, std::function<void()>&& cb);
+    void     cancel(uint64_t handle);
+    size_t   pending() const;
+
+  private:
+    struct SEntry {
+        uint64_t              handle   = 0;
+        Clock::time_point     deadline;
+        std::function<void()> cb;
+    };
+
+    void                                 onTick();
+    void                                 arm();
+    uint64_t                             tickOf(Clock::time_point at) const;
+
+    std::chrono::milliseconds            m_tick;
+    std::vector<std::vector<SEntry>>     m_slots;
+    // handle -> index into m_slots, for cancel()
+    std::unordered_map<uint64_t, size_t> m_slotOf;
+    Clock::time_point                    m_epoch = Clock::now();
+    // next tick to process
+    uint64_t                             m_cursor = 0;
+    uint64_t                             m_nextHandle = 1;
+    size_t                               m_pending    = 0;
+
+    SP<CEventLoopTimer>                  m_timer;
+    // the tick m_timer wakes up after
+    std::optional<uint64_t>              m_armedTick;
+};
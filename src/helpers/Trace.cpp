@@ -0,0 +1,123 @@
+#include "Trace.hpp"
+#include "Logger.hpp"
+#include "Json.hpp"
+
+#include <format>
+#include <cstring>
+
+#include <unistd.h>
+
+bool CTrace::open(const std::string& path) {
+    m_file.open(path, std::ios::out | std::ios::trunc);
+
+    if (!m_file.is_open()) {
+        g_logger->log(LOG_ERR, "Couldn't open trace file {}: {}", path, strerror(errno));
+        return false;
+    }
+
+    m_enabled = true;
+    m_pid     = getpid();
+    m_started = Clock::now();
+    m_out     = "{\"traceEvents\":[\n";
+
+    return true;
+}
+
+void CTrace::finish() {
+    if (!m_enabled)
+        return;
+
+    complete("hyprshutdown", "total", m_started, Clock::now());
+
+    m_enabled = false;
+
+    // no trailing comma after the last event
+    if (m_out.ends_with(",\n"))
+        m_out.resize(m_out.size() - 2);
+
+    m_out += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    m_file << m_out;
+    m_file.close();
+    m_out.clear();
+}
+
+void CTrace::complete(std::string_view name, std::string_view cat, Clock::time_point start, Clock::time_point end, std::initializer_list<Arg> args) {
+    if (!m_enabled)
+        return;
+
+    event('X', name, cat, start, args, std::max<int64_t>(micros(end) - micros(start), 0));
+}
+
+void CTrace::instant(std::string_view name, std::string_view cat, std::initializer_list<Arg> args) {
+    if (!m_enabled)
+        return;
+
+    event('i', name, cat, Clock::now(), args);
+}
+
+void CTrace::counter(std::string_view name, int64_t value) {
+    if (!m_enabled)
+        return;
+
+    event('C', name, "counter", Clock::now(), {{"value", value}});
+}
+
+void CTrace::asyncBegin(std::string_view name, std::string_view cat, uint64_t id, Clock::time_point at, std::initializer_list<Arg> args) {
+    if (!m_enabled)
+        return;
+
+    event('b', name, cat, at, args, -1, id);
+}
+
+void CTrace::asyncEnd(std::string_view name, std::string_view cat, uint64_t id, Clock::time_point at, std::initializer_list<Arg> args) {
+    if (!m_enabled)
+        return;
+
+    event('e', name, cat, at, args, -1, id);
+}
+
+void CTrace::event(char phase, std::string_view name, std::string_view cat, Clock::time_point at, std::initializer_list<Arg> args, int64_t durUs, uint64_t id) {
+    m_out += "{\"name\":\"";
+    Json::appendEscaped(m_out, name);
+    m_out += "\",\"cat\":\"";
+    Json::appendEscaped(m_out, cat);
+    m_out += std::format("\",\"ph\":\"{}\",\"ts\":{},\"pid\":{},\"tid\":{}", phase, micros(at), m_pid, m_pid);
+
+    if (durUs >= 0)
+        m_out += std::format(",\"dur\":{}", durUs);
+
+    if (phase == 'b' || phase == 'e')
+        m_out += std::format(",\"id\":\"0x{:x}\"", id);
+
+    if (phase == 'i')
+        m_out += ",\"s\":\"p\"";
+
+    if (args.size() > 0) {
+        m_out += ",\"args\":{";
+
+        for (const auto& [key, value] : args) {
+            m_out += '"';
+            Json::appendEscaped(m_out, key);
+            m_out += "\":";
+
+            if (std::holds_alternative<int64_t>(value))
+                m_out += std::to_string(std::get<int64_t>(value));
+            else {
+                m_out += '"';
+                Json::appendEscaped(m_out, std::get<std::string_view>(value));
+                m_out += '"';
+            }
+
+            m_out += ',';
+        }
+
+        m_out.back() = '}';
+    }
+
+    m_out += "},\n";
+}
+
+int64_t CTrace::micros(Clock::time_point at) const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(at - m_started).count();
+}
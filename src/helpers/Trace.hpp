@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <initializer_list>
+#include <optional>
+#include <variant>
+
+#include "Memory.hpp"
+
+// Records a timeline of the shutdown in the Chrome trace event format, which Perfetto and chrome://tracing load.
+// Everything is a no-op until open() is called.
+class CTrace {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Arg   = std::pair<std::string_view, std::variant<int64_t, std::string_view>>;
+
+    CTrace()  = default;
+    ~CTrace() = default;
+
+    CTrace(const CTrace&) = delete;
+    CTrace(CTrace&)       = delete;
+    CTrace(CTrace&&)      = delete;
+
+    bool open(const std::string& path);
+    // writes the file. Events after this are dropped.
+    void finish();
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    // a finished span
+    void complete(std::string_view name, std::string_view cat, Clock::time_point start, Clock::time_point end, std::initializer_list<Arg> args = {});
+    void instant(std::string_view name, std::string_view cat, std::initializer_list<Arg> args = {});
+    void counter(std::string_view name, int64_t value);
+    // spans that overlap each other, like apps shutting down. id ties begin and end together.
+    void asyncBegin(std::string_view name, std::string_view cat, uint64_t id, Clock::time_point at, std::initializer_list<Arg> args = {});
+    void asyncEnd(std::string_view name, std::string_view cat, uint64_t id, Clock::time_point at, std::initializer_list<Arg> args = {});
+
+  private:
+    void              event(char phase, std::string_view name, std::string_view cat, Clock::time_point at, std::initializer_list<Arg> args, int64_t durUs = -1, uint64_t id = 0);
+    int64_t           micros(Clock::time_point at) const;
+
+    bool              m_enabled = false;
+    int               m_pid     = 0;
+    std::ofstream     m_file;
+    std::string       m_out;
+    Clock::time_point m_started;
+};
+
+inline UP<CTrace> g_trace = makeUnique<CTrace>();
+
+// Records a complete event for its scope
+class CTraceSpan {
+  public:
+    CTraceSpan(std::string_view name, std::string_view cat) : m_name(name), m_cat(cat) {
+        if (g_trace->enabled())
+            m_start = CTrace::Clock::now();
+    }
+
+    ~CTraceSpan() {
+        if (!g_trace->enabled() || m_start == CTrace::Clock::time_point{})
+            return;
+
+        if (m_count)
+            g_trace->complete(m_name, m_cat, m_start, CTrace::Clock::now(), {{"count", *m_count}});
+        else
+            g_trace->complete(m_name, m_cat, m_start, CTrace::Clock::now());
+    }
+
+    CTraceSpan(const CTraceSpan&) = delete;
+    CTraceSpan(CTraceSpan&)       = delete;
+    CTraceSpan(CTraceSpan&&)      = delete;
+
+    // shows up as the span's "count" arg
+    void setCount(int64_t count) {
+        m_count = count;
+    }
+
+  private:
+    std::string_view          m_name, m_cat;
+    CTrace::Clock::time_point m_start;
+    std::optional<int64_t>    m_count;
+};
@@ -1,15 +1,27 @@
 #include "helpers/Asserts.hpp"
 #include "ui/UI.hpp"
 #include "state/AppState.hpp"
+#include "state/Shutdown.hpp"
+#include "state/HyprlandIPC.hpp"
+#include "state/Daemon.hpp"
+#include "helpers/EventLoop.hpp"
+#include "helpers/Trace.hpp"
+#include "helpers/Progress.hpp"
+#include "config/ConfigManager.hpp"
 
 #include <csignal>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <hyprutils/cli/ArgumentParser.hpp>
 #include <hyprutils/os/Process.hpp>
+#include <hyprutils/utils/ScopeGuard.hpp>
 
+#include <algorithm>
+#include <cerrno>
 #include <print>
+#include <vector>
 
 using namespace Hyprutils::OS;
 
@@ -35,6 +47,146 @@ static void forkoff() {
     umask(0);
 }
 
+// --all-instances workers, for forwarding signals to
+static std::vector<pid_t> s_workers;
+
+static void forwardSignal(int sig) {
+    for (const auto& pid : s_workers) {
+        kill(pid, sig);
+    }
+}
+
+// The app state and the IPC are process-wide, so every live instance gets a worker process of its own.
+// Returns the instance to shut down in a worker. In the parent, returns nothing once all workers are done,
+// with status 1 if any of them failed, the worst of their outcomes otherwise.
+static std::optional<HyprlandIPC::SInstanceData> forkWorkers(int& status, bool& allExited) {
+    const auto INSTANCES = HyprlandIPC::instances();
+
+    status    = 0;
+    allExited = true;
+
+    if (INSTANCES.empty()) {
+        g_logger->log(LOG_ERR, "No running Hyprland instances found");
+        status = 1;
+        return std::nullopt;
+    }
+
+    // errors win over any outcome, an instance may not have been shut down at all
+    bool failed = false;
+
+    // write ends, one per worker. Each worker waits for the pids of all of them before starting, so it can spare its siblings.
+    std::vector<int> pidPipes;
+
+    for (const auto& instance : INSTANCES) {
+        int fds[2] = {-1, -1};
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            g_logger->log(LOG_ERR, "Failed to create a pipe for instance {}", instance.id);
+            failed    = true;
+            allExited = false;
+            continue;
+        }
+
+        const pid_t PID = fork();
+
+        if (PID < 0) {
+            g_logger->log(LOG_ERR, "Failed to fork a worker for instance {}", instance.id);
+            close(fds[0]);
+            close(fds[1]);
+            failed    = true;
+            allExited = false;
+            continue;
+        }
+
+        if (PID == 0) {
+            // so the read below sees EOF once the parent is done writing
+            close(fds[1]);
+            for (const auto& fd : pidPipes) {
+                close(fd);
+            }
+
+            std::vector<int64_t> siblings;
+            pid_t                pid = 0;
+            ssize_t              len = 0;
+            while ((len = read(fds[0], &pid, sizeof(pid))) != 0) {
+                if (len == sc<ssize_t>(sizeof(pid)))
+                    siblings.emplace_back(pid);
+                else if (len < 0 && errno != EINTR)
+                    break;
+            }
+            close(fds[0]);
+
+            // a nested compositor is usually in the tree of a terminal of another one, both workers must leave each other's alone
+            for (const auto& other : INSTANCES) {
+                if (other.id != instance.id && other.pid > 0)
+                    siblings.emplace_back(other.pid);
+            }
+
+            // the coordinator is our parent, which sparedPids() covers already
+            State::state()->m_spared = std::move(siblings);
+
+            s_workers.clear();
+            // the parent's epoll and timerfd would be shared between all workers
+            g_loop = makeUnique<CEventLoop>();
+            return instance;
+        }
+
+        close(fds[0]);
+        pidPipes.emplace_back(fds[1]);
+
+        g_logger->log(LOG_DEBUG, "Shutting down instance {} in worker {}", instance.id, PID);
+        s_workers.emplace_back(PID);
+    }
+
+    // at most a few pids each, well below PIPE_BUF, so the writes don't block or split
+    for (const auto& fd : pidPipes) {
+        for (const auto& pid : s_workers) {
+            while (write(fd, &pid, sizeof(pid)) < 0 && errno == EINTR) {
+                ;
+            }
+        }
+        close(fd);
+    }
+
+    signal(SIGINT, forwardSignal);
+    signal(SIGTERM, forwardSignal);
+
+    for (const auto& pid : s_workers) {
+        int wstatus = 0;
+        while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+            ;
+        }
+
+        const int CODE = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+
+        // errors and cancels leave their compositor running
+        if (CODE == 1 || CODE == CShutdown::OUTCOME_CANCELLED)
+            allExited = false;
+
+        if (CODE == 1)
+            failed = true;
+        else
+            status = std::max(status, CODE);
+    }
+
+    if (failed)
+        status = 1;
+
+    return std::nullopt;
+}
+
+// VT switch for NVIDIA+SDDM: after Hyprland exits, the display may not
+// automatically switch back to the greeter's VT, causing a black screen.
+// This explicitly switches to the specified VT to fix it.
+static void switchVt(std::optional<int> vt) {
+    if (!vt || *vt <= 0 || State::state()->m_dryRun)
+        return;
+
+    g_logger->log(LOG_DEBUG, "Switching to VT{}", *vt);
+    std::string cmd = std::format("sudo -n chvt {}", *vt);
+    CProcess    proc("/bin/sh", {"-c", cmd});
+    proc.runAsync();
+}
+
 int main(int argc, const char** argv, const char** envp) {
     Hyprutils::CLI::CArgumentParser parser({argv, sc<size_t>(argc)});
 
@@ -42,8 +194,18 @@ int main(int argc, const char** argv, const char** envp) {
     ASSERT(parser.registerBoolOption("no-exit", "", "Do not exit hyprland once apps close"));
     ASSERT(parser.registerStringOption("top-label", "t", "Set the text appearing on top (set to \"Shutting down...\" by default)"));
     ASSERT(parser.registerStringOption("post-cmd", "p", "Set a command ran after all apps and Hyprland shut down"));
+    ASSERT(parser.registerStringOption("config", "c", "Path to the config (default: $XDG_CONFIG_HOME/hypr/hyprshutdown.conf)"));
     ASSERT(parser.registerBoolOption("verbose", "", "Enable more logging"));
+    ASSERT(parser.registerStringOption("trace-file", "", "Write a timeline of the shutdown to a file, in the Chrome trace format (loadable in Perfetto)"));
+    ASSERT(parser.registerIntOption("progress-fd", "", "Write progress to fd N, as newline-delimited JSON events"));
+    ASSERT(parser.registerBoolOption("json-progress", "", "Write progress to stdout, as newline-delimited JSON events"));
     ASSERT(parser.registerBoolOption("no-fork", "", "Do not fork/daemonize (run in foreground)"));
+    ASSERT(parser.registerBoolOption("no-ui", "", "Do not show the UI, report progress on stderr instead. Use with --no-fork for the exit status"));
+    ASSERT(parser.registerIntOption("timeout", "", "Force quit apps still open after N seconds"));
+    ASSERT(parser.registerIntOption("ui-delay", "", "Only show the UI if apps are still open after N ms, 0 shows it right away (default: 300)"));
+    ASSERT(parser.registerBoolOption("all-instances", "", "Shut down every running Hyprland instance at once, not just the current one"));
+    ASSERT(parser.registerBoolOption("daemon", "", "Stay resident, keeping track of apps, and shut down once --trigger is ran"));
+    ASSERT(parser.registerBoolOption("trigger", "", "Start the shutdown in a running --daemon, or shut down as usual if there's none"));
     ASSERT(parser.registerIntOption("vt", "", "Switch to VT N after Hyprland exits (fixes NVIDIA+SDDM black screen)"));
     ASSERT(parser.registerBoolOption("help", "h", "Show the help menu"));
 
@@ -63,12 +225,34 @@ int main(int argc, const char** argv, const char** envp) {
     if (parser.getBool("dry-run").value_or(false))
         State::state()->m_dryRun = true;
 
+    if (const auto FD = parser.getInt("progress-fd"); FD) {
+        if (!g_progress->open(*FD))
+            return 1;
+    } else if (parser.getBool("json-progress").value_or(false))
+        g_progress->open(STDOUT_FILENO);
+
+    const bool ALL_INSTANCES = parser.getBool("all-instances").value_or(false);
+    const bool DAEMON        = parser.getBool("daemon").value_or(false);
+
+    if (DAEMON && ALL_INSTANCES) {
+        g_logger->log(LOG_ERR, "--daemon and --all-instances can't be combined, run a daemon per instance instead");
+        return 1;
+    }
+
     const auto HIS = getenv("HYPRLAND_INSTANCE_SIGNATURE");
-    if (!HIS || HIS[0] == '\0') {
+    if (!ALL_INSTANCES && (!HIS || HIS[0] == '\0')) {
         g_logger->log(LOG_ERR, "Cannot run under a non-hyprland environment");
         return 1;
     }
 
+    // the daemon runs with its own options, these are only for when there's none
+    if (parser.getBool("trigger").value_or(false) && !ALL_INSTANCES) {
+        if (CDaemon::trigger())
+            return 0;
+
+        g_logger->log(LOG_WARN, "No hyprshutdown daemon running, shutting down directly");
+    }
+
     // By default, hyprshutdown forks to avoid being killed when the parent terminal closes.
     // The --no-fork option runs in the foreground, useful for debugging or scripting.
     if (!parser.getBool("no-fork").value_or(false))
@@ -78,30 +262,93 @@ int main(int argc, const char** argv, const char** envp) {
         signal(SIGHUP, SIG_IGN); // Still ignore SIGHUP to survive terminal disconnect
     }
 
+    auto                       vtSwitch = parser.getInt("vt");
+    std::optional<std::string> postExitCmd{parser.getString("post-cmd")};
+    std::optional<std::string> tracePath{parser.getString("trace-file")};
+
+    if (ALL_INSTANCES) {
+        int        status    = 0;
+        bool       allExited = false;
+        const auto WORKER    = forkWorkers(status, allExited);
+
+        if (!WORKER) {
+            // once for the whole session, like with a single instance
+            if (postExitCmd && allExited && !parser.getBool("no-exit").value_or(false) && !State::state()->m_dryRun) {
+                CProcess proc("/bin/sh", {"-c", postExitCmd.value()});
+                proc.runAsync();
+            }
+
+            switchVt(vtSwitch);
+            return status;
+        }
+
+        setenv("HYPRLAND_INSTANCE_SIGNATURE", WORKER->id.c_str(), 1);
+        setenv("WAYLAND_DISPLAY", WORKER->wlSocket.c_str(), 1);
+
+        g_shutdown->m_instanceName = WORKER->id;
+        g_progress->m_instance     = WORKER->id;
+
+        if (tracePath)
+            tracePath = std::format("{}.{}", *tracePath, WORKER->id);
+
+        // the parent handles both
+        vtSwitch.reset();
+        postExitCmd.reset();
+    }
+
+    if (tracePath)
+        g_trace->open(*tracePath);
+
+    auto traceGuard = Hyprutils::Utils::CScopeGuard([] { g_trace->finish(); });
+
+    if (const auto CONFIG = parser.getString("config"); CONFIG)
+        g_config->init(std::string{*CONFIG});
+    else
+        g_config->init();
+
+    if (DAEMON) {
+        g_daemon = makeUnique<CDaemon>();
+
+        if (!g_daemon->listen())
+            return 1;
+
+        State::state()->m_resident = true;
+    }
+
     if (!State::state()->init()) {
         g_logger->log(LOG_ERR, "Failed to init state");
         return 1;
     }
 
-    g_ui                  = makeUnique<CUI>();
-    g_ui->m_noExit        = parser.getBool("no-exit").value_or(false) || State::state()->m_dryRun;
-    g_ui->m_shutdownLabel = parser.getString("top-label").value_or("Shutting down...");
-    g_ui->m_postExitCmd   = parser.getString("post-cmd");
+    g_shutdown->m_noExit      = parser.getBool("no-exit").value_or(false) || State::state()->m_dryRun;
+    g_shutdown->m_postExitCmd = postExitCmd;
+
+    if (const auto TIMEOUT = parser.getInt("timeout"); TIMEOUT && *TIMEOUT > 0)
+        g_shutdown->m_timeout = std::chrono::seconds(*TIMEOUT);
 
-    // Capture VT switch option before running UI
-    auto vtSwitch = parser.getInt("vt");
+    bool headless = parser.getBool("no-ui").value_or(false);
 
-    g_ui->run();
+    if (!headless) {
+        g_ui                  = makeUnique<CUI>();
+        g_ui->m_shutdownLabel = parser.getString("top-label").value_or("Shutting down...");
 
-    // VT switch for NVIDIA+SDDM: after Hyprland exits, the display may not
-    // automatically switch back to the greeter's VT, causing a black screen.
-    // This explicitly switches to the specified VT to fix it.
-    if (vtSwitch && *vtSwitch > 0 && !State::state()->m_dryRun) {
-        g_logger->log(LOG_DEBUG, "Switching to VT{}", *vtSwitch);
-        std::string cmd = std::format("sudo -n chvt {}", *vtSwitch);
-        CProcess proc("/bin/sh", {"-c", cmd});
-        proc.runAsync();
+        if (const auto DELAY = parser.getInt("ui-delay"); DELAY)
+            g_ui->m_overlayDelay = std::chrono::milliseconds(std::max(*DELAY, 0));
+
+        if (!(DAEMON ? g_ui->runResident() : g_ui->run())) {
+            g_logger->log(LOG_WARN, "Failed to start the UI, continuing without it");
+            g_ui.reset();
+            headless = true;
+        }
     }
 
-    return 0;
+    if (headless && DAEMON)
+        g_daemon->waitForTrigger();
+
+    // 0: all apps closed, 2: force killed, 3: cancelled, 4: timed out
+    const int STATUS = headless ? g_shutdown->runHeadless() : g_shutdown->outcome();
+
+    switchVt(vtSwitch);
+
+    return STATUS;
 }
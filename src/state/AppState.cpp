@@ -2,73 +2,111 @@
 #include "HyprlandIPC.hpp"
 #include "../helpers/Logger.hpp"
 #include "../helpers/OS.hpp"
+#include "../helpers/Cgroup.hpp"
+#include "../helpers/Trace.hpp"
+#include "../helpers/Progress.hpp"
+#include "../config/ConfigManager.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <functional>
+#include <optional>
 #include <ranges>
 #include <csignal>
+#include <utility>
+#include <thread>
+#include <unordered_set>
+
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
 #include <hyprutils/string/String.hpp>
 
 using namespace State;
 
-static const std::vector<const char*> IGNORE_DAEMONS = {
+static const std::vector<std::string_view> IGNORE_DAEMONS = {
     "Xwayland",
 };
 
+// parents that are part of the app, like flatpak's bwrap. They tend to be the last to go.
+static const std::vector<std::string_view> SANDBOX_SHIMS = {
+    "bwrap",
+};
+
+// a tree has a pidfd per process, this keeps a fork bomb from eating our fds
+constexpr size_t MAX_TREE_SIZE = 512;
+// and this all trees together, well below the usual limit of 1024 fds. The rest is signalled by pid.
+constexpr size_t MAX_TREE_PIDFDS = 256;
+// processes below the other instances' compositors and workers that are left alone, a whole nested session fits
+constexpr size_t MAX_SPARED_SUBTREES = 4096;
+
+// with the event socket, j/clients is only a consistency check against missed events
+constexpr auto RESYNC_INTERVAL = std::chrono::seconds(5);
+// an app isn't stuck before this, however fast its class usually is
+constexpr auto MIN_STUCK_AFTER = std::chrono::seconds(1);
+
 SP<CAppState> State::state() {
     static auto state = makeShared<CAppState>();
     return state;
 }
 
-CApp::CApp(glz::generic::object_t& object) {
-    if (object.contains("address"))
-        m_address = object["address"].get_string();
-    if (object.contains("title"))
-        m_title = object["title"].get_string();
-    if (object.contains("class"))
-        m_class = object["class"].get_string();
-    if (object.contains("namespace")) {
-        m_class        = object["namespace"].get_string();
-        m_alwaysUsePid = true; // layers cant be closewindow'd
-    }
-    if (object.contains("xwayland"))
-        m_xwayland = object["xwayland"].get_boolean();
-    if (object.contains("pid"))
-        m_pid = sc<int64_t>(object["pid"].get_number());
+// window addresses are hex, with or without the 0x. The events leave it out.
+static std::optional<uint64_t> parseAddress(std::string_view address) {
+    if (address.starts_with("0x"))
+        address.remove_prefix(2);
+
+    uint64_t   value = 0;
+    const auto RES   = std::from_chars(address.data(), address.data() + address.size(), value, 16);
+
+    if (RES.ec != std::errc{} || RES.ptr != address.data() + address.size())
+        return std::nullopt;
+
+    return value;
 }
 
-CApp::CApp(const std::string& name, int pid) : m_class(name), m_pid(pid), m_alwaysUsePid(true) {
+CApp::CApp(const HyprlandIPC::SClient& client, CStringPool& strings) :
+    m_address(parseAddress(client.address).value_or(0)), m_pid(client.pid), m_hasWindow(m_address != 0), m_xwayland(client.xwayland), m_class(strings.intern(client.clazz)),
+    m_title(client.title) {
     ;
 }
 
-void CApp::quit() {
-    if (!m_alwaysUsePid && (!m_address.empty() || m_pid <= 0)) {
-        // for apps that have an address, use closewindow. Some apps don't ask for saving on SIGTERM
-        if (m_address.empty()) {
-            g_logger->log(LOG_WARN, "CApp::quit: app {} has no address and no valid pid, skipping", m_class);
-            return;
-        }
-        g_logger->log(LOG_TRACE, "CApp::quit: using close for {}", m_class);
-        std::string cmd;
-        if (State::state()->m_useLua)
-            cmd = std::format("/dispatch hl.dsp.window.close({{ window = 'address:{}' }})", m_address);
-        else
-            cmd = std::format("/dispatch closewindow address:{}", m_address);
-        auto ret = HyprlandIPC::getFromSocket(cmd);
-        if (!ret)
-            g_logger->log(LOG_ERR, "Failed closing window {}: ipc err", m_class);
-        else if (*ret != "ok")
-            g_logger->log(LOG_ERR, "Failed closing window {}: {}", m_class, *ret);
-    } else {
-        // SIGTERM with pid
-        if (m_pid <= 0) {
-            g_logger->log(LOG_WARN, "CApp::quit: app {} has invalid pid {}, skipping SIGTERM", m_class, m_pid);
-            return;
-        }
-        g_logger->log(LOG_TRACE, "CApp::quit: using SIGTERM for {}, pid {}", m_class, m_pid);
-        if (::kill(m_pid, SIGTERM) != 0)
-            g_logger->log(LOG_ERR, "CApp::quit: signal failed for pid {}, err: {}", m_pid, strerror(errno));
-    }
+// layers cant be closewindow'd
+CApp::CApp(const HyprlandIPC::SLayer& layer, CStringPool& strings) :
+    m_address(parseAddress(layer.address).value_or(0)), m_pid(layer.pid), m_group(Config::GROUP_LAYERS), m_alwaysUsePid(true), m_class(strings.intern(layer.nameSpace)) {
+    ;
+}
+
+CApp::CApp(std::string_view name, int pid, CStringPool& strings) : m_pid(pid), m_group(Config::GROUP_BACKGROUND), m_alwaysUsePid(true), m_class(strings.intern(name)) {
+    ;
+}
+
+CApp::CApp(uint64_t address, std::string_view clazz, std::string_view title, CStringPool& strings) :
+    m_address(address), m_hasWindow(true), m_class(strings.intern(clazz)), m_title(title) {
+    ;
+}
+
+uint64_t CApp::nextId() {
+    static uint64_t id = 0;
+    return ++id;
+}
+
+CApp::~CApp() {
+    if (m_pidfd.isValid())
+        g_loop->removeFd(m_pidfd.get());
+}
+
+bool CApp::closesByWindow() const {
+    return !m_alwaysUsePid && (m_address != 0 || m_pid <= 0);
+}
+
+std::string CApp::closeCommand() const {
+    if (State::state()->m_useLua)
+        return std::format("/dispatch hl.dsp.window.close({{ window = 'address:0x{:x}' }})", m_address);
+    return std::format("/dispatch closewindow address:0x{:x}", m_address);
 }
 
 void CApp::kill() {
@@ -78,14 +116,81 @@ void CApp::kill() {
     }
 
     g_logger->log(LOG_TRACE, "CApp::kill: killing {}, pid {}", m_class, m_pid);
-    if (::kill(m_pid, SIGKILL) != 0)
-        g_logger->log(LOG_ERR, "CApp::quit: signal failed for pid {}, err: {}", m_pid, strerror(errno));
+    if (!sendSignal(SIGKILL))
+        g_logger->log(LOG_ERR, "CApp::kill: signal failed for pid {}, err: {}", m_pid, strerror(errno));
+}
+
+static bool signalProcess(const Hyprutils::OS::CFileDescriptor& pidfd, int64_t pid, int sig) {
+    // through the pidfd the signal can't hit a recycled pid
+    if (pidfd.isValid())
+        return OS::pidfdSendSignal(pidfd.get(), sig);
+
+    return ::kill(pid, sig) == 0;
+}
+
+bool CApp::sendSignal(int sig) {
+    bool       sent     = false;
+    // what the first failing call said, later calls overwrite errno
+    int        firstErr = ESRCH;
+    bool       failed   = false;
+
+    const auto SIGNAL = [&](const Hyprutils::OS::CFileDescriptor& pidfd, int64_t pid) {
+        if (signalProcess(pidfd, pid, sig)) {
+            sent = true;
+            return;
+        }
+
+        if (!std::exchange(failed, true))
+            firstErr = errno;
+    };
+
+    // the app first, it may want to take its helpers down itself
+    if (!m_exited && !m_pidExited)
+        SIGNAL(m_pidfd, m_pid);
+
+    for (const auto& p : m_tree) {
+        SIGNAL(p.pidfd, p.pid);
+    }
+
+    if (!sent)
+        errno = firstErr;
+
+    return sent;
+}
+
+bool CApp::openPidfd() {
+    if (m_pid <= 0 || m_pidExited || m_pidfd.isValid())
+        return m_pidfd.isValid();
+
+    m_pidfd = Hyprutils::OS::CFileDescriptor{OS::pidfdOpen(m_pid)};
+
+    if (!m_pidfd.isValid() && errno == ESRCH) {
+        m_exited    = true;
+        m_pidExited = true;
+    }
+
+    return m_pidfd.isValid();
 }
 
 bool CApp::appAlive() const {
+    // CAppState::pruneTrees() keeps this to what's alive
+    if (!m_tree.empty())
+        return true;
+
+    if (m_exited)
+        return false;
+
+    // the whole cgroup has to go, not just our pid
+    if (m_cgroupWatched)
+        return true;
+
     if (m_pid <= 0)
         return false;
 
+    // exits are reported through the pidfd
+    if (m_pidfd.isValid())
+        return true;
+
     if (::kill(m_pid, 0) == 0)
         return true;
 
@@ -95,211 +200,1092 @@ bool CApp::appAlive() const {
     return false;
 }
 
-bool CApp::operator==(const glz::generic& object) const {
-    if (!object.contains("address"))
+bool CAppState::init() {
+    CTraceSpan span("init", "state");
+
+    m_history.load();
+
+    // subscribe to events before fetching anything, so nothing can slip in between
+    if (m_eventSocket.connect()) {
+        g_logger->log(LOG_DEBUG, "Connected to the event socket");
+        g_loop->addFd(m_eventSocket.fd(), [this] { onEventSocket(); });
+    } else
+        g_logger->log(LOG_WARN, "Couldn't connect to the event socket, falling back to polling");
+
+    // the process table doesn't need the compositor, read it while it answers
+    CTrace::Clock::time_point scanStart, scanEnd;
+    bool                      scanned = false;
+
+    std::jthread              scanner([this, &scanStart, &scanEnd, &scanned] {
+        scanStart = CTrace::Clock::now();
+        scanned   = m_processes.snapshot(std::thread::hardware_concurrency());
+        scanEnd   = CTrace::Clock::now();
+    });
+
+    // j/status, j/clients and j/layers are in flight together. Windows start closing once the first two are in,
+    // the config provider decides how closewindow is spelled.
+    bool       ok          = true;
+    bool       statusDone  = false;
+    bool       clientsDone = false;
+    size_t     pending     = 3;
+
+    const auto ARRIVED = [&pending] {
+        if (--pending == 0)
+            g_loop->leaveLoop();
+    };
+
+    const auto CLOSE_WINDOWS = [this, &ok, &statusDone, &clientsDone] {
+        if (!ok || !statusDone || !clientsDone || m_dryRun || m_resident)
+            return;
+
+        closeWindowsEarly();
+    };
+
+    HyprlandIPC::request("j/status", [this, &statusDone, &CLOSE_WINDOWS, &ARRIVED](std::expected<std::string_view, std::string>&& ret) {
+        HyprlandIPC::SStatus status;
+        if (ret && !glz::read<HyprlandIPC::JSON_OPTS>(status, *ret) && !status.configProvider.empty()) {
+            m_useLua = (status.configProvider == "lua");
+            g_logger->log(LOG_DEBUG, "Detected config provider: {}", m_useLua ? "lua" : "hyprlang");
+        }
+
+        statusDone = true;
+        CLOSE_WINDOWS();
+        ARRIVED();
+    });
+
+    HyprlandIPC::request("j/clients", [this, &ok, &clientsDone, &CLOSE_WINDOWS, &ARRIVED](std::expected<std::string_view, std::string>&& ret) {
+        if (!ret) {
+            g_logger->log(LOG_ERR, "Couldn't get clients from socket: {}", ret.error());
+            ok = false;
+        } else if (!applyClients(*ret))
+            ok = false;
+
+        clientsDone = true;
+        CLOSE_WINDOWS();
+        ARRIVED();
+    });
+
+    // windows may be closing by the time this arrives, so no layers isn't fatal anymore
+    HyprlandIPC::request("j/layers", [this, &ARRIVED](std::expected<std::string_view, std::string>&& ret) {
+        std::map<std::string, HyprlandIPC::SMonitorLayers> monitors;
+
+        if (!ret)
+            g_logger->log(LOG_ERR, "Couldn't get layers from socket: {}", ret.error());
+        else if (const auto ERR = glz::read<HyprlandIPC::JSON_OPTS>(monitors, *ret); ERR) {
+            g_logger->log(LOG_ERR, "Socket returned bad data: {}", glz::format_error(ERR, *ret));
+            monitors.clear();
+        }
+
+        for (const auto& [mon, layers] : monitors) {
+            for (const auto& [level, list] : layers.levels) {
+                for (const auto& layer : list) {
+                    addApp(makeUnique<CApp>(layer, m_strings));
+                }
+            }
+        }
+
+        ARRIVED();
+    });
+
+    // failed requests can call back right away
+    while (pending > 0) {
+        g_loop->enterLoop();
+    }
+
+    if (!ok)
         return false;
 
-    return m_address == object["address"].get_string();
+    g_logger->log(LOG_DEBUG, "Parsed {} apps from socket", m_apps.size());
+
+    scanner.join();
+
+    if (!scanned)
+        g_logger->log(LOG_ERR, "Can't get children: failed to read the process table");
+
+    g_trace->complete("process scan", "state", scanStart, scanEnd, {{"count", sc<int64_t>(m_processes.processes().size())}});
+
+    discoverChildren();
+
+    if (!m_resident)
+        beginShutdown();
+
+    return true;
 }
 
-bool CAppState::init() {
+void CAppState::beginShutdown() {
+    // exit them if not dry run
+    if (m_dryRun)
+        return;
 
-    // detect config provider
-    {
-        const auto RET = HyprlandIPC::getFromSocket("j/status");
-        if (RET) {
-            auto jsonRaw = glz::read_json<glz::generic>(*RET);
-            if (jsonRaw && jsonRaw->get_object().contains("configProvider")) {
-                std::string provider = jsonRaw->get_object()["configProvider"].get_string();
-                m_useLua = (provider == "lua");
-                g_logger->log(LOG_DEBUG, "Detected config provider: {}", m_useLua ? "lua" : "hyprlang");
+    if (m_resident) {
+        m_started = std::chrono::steady_clock::now();
+
+        // windows first, they don't need the process table
+        closeWindowsEarly();
+
+        // the registry only follows windows through events, background processes may have come and gone
+        CTraceSpan scanSpan("process scan", "state");
+        if (!m_processes.snapshot(std::thread::hardware_concurrency()))
+            g_logger->log(LOG_ERR, "Can't get children: failed to read the process table");
+        scanSpan.setCount(sc<int64_t>(m_processes.processes().size()));
+
+        discoverChildren();
+    }
+
+    if (m_groupStarted)
+        quitApps(true); // windows are closing already, this is for whatever turned up since
+    else
+        advanceGroups();
+
+    scheduleReclose();
+}
+
+void CAppState::closeWindowsEarly() {
+    if (m_groupStarted || std::ranges::none_of(m_apps, [](const auto& a) { return a->m_group == Config::GROUP_WINDOWS; }))
+        return;
+
+    advanceGroups();
+}
+
+void CAppState::discoverChildren() {
+    // background processes of the session. Hyprland's cgroup also has everything that double-forked away from it,
+    // direct children are the fallback for BSDs, which don't do cgroups.
+    // TODO: make a kernel cgroup in hl, so apps get their own cgroups we can kill and wait on.
+    const auto INSTANCE = HyprlandIPC::currentInstance();
+
+    if (!INSTANCE)
+        g_logger->log(LOG_ERR, "Can't get children: {}", INSTANCE.error());
+    else if ((*INSTANCE)->pid <= 0)
+        g_logger->log(LOG_ERR, "Can't get children: no live compositor in the instance's lock file");
+    else {
+        // before background processes are looked for, so helpers of apps don't become apps of their own
+        collectTrees();
+
+        if (!m_useCgroups || !discoverSessionCgroup((*INSTANCE)->pid)) {
+            // we may be one of them
+            const auto SPARED = sparedPids((*INSTANCE)->pid);
+
+            // get all processes that have a PPid of us
+            for (const auto& proc : m_processes.childrenOf((*INSTANCE)->pid)) {
+                if (proc.state == 'Z' || std::ranges::contains(IGNORE_DAEMONS, proc.name()) || m_byPid.contains(proc.pid) || m_treePids.contains(proc.pid) ||
+                    std::ranges::contains(SPARED, proc.pid))
+                    continue;
+
+                addApp(makeUnique<CApp>(proc.name(), proc.pid, m_strings));
             }
         }
     }
 
-    // windows
-    {
-        const auto RET = HyprlandIPC::getFromSocket("j/clients");
+    // and now of those background processes
+    collectTrees();
+}
 
-        if (!RET) {
-            g_logger->log(LOG_ERR, "Couldn't get clients from socket");
-            return false;
-        }
+void CAppState::collectTrees() {
+    // with --no-fork from a terminal, we and our shell are in its tree
+    const auto SPARED = sparedPids();
+    const auto KNOWN  = [this, &SPARED](int64_t pid) { return m_byPid.contains(pid) || m_treePids.contains(pid) || std::ranges::contains(SPARED, pid); };
 
-        auto jsonRaw = glz::read_json<glz::generic>(*RET);
+    size_t                      added = 0;
+    // windows of one process share a tree, the first one has it
+    std::unordered_set<int64_t> roots;
 
-        if (!jsonRaw) {
-            g_logger->log(LOG_ERR, "Socket returned bad data");
-            return false;
+    for (const auto& a : m_apps) {
+        if (a->m_pid <= 0 || a->m_cgroupWatched || m_treePids.contains(a->m_pid) || !roots.emplace(a->m_pid).second)
+            continue;
+
+        std::vector<int64_t> queue = {a->m_pid};
+
+        const auto           ADD = [this, &a, &queue, &added](int64_t pid) {
+            Hyprutils::OS::CFileDescriptor pidfd;
+
+            if (m_treePidfds < MAX_TREE_PIDFDS) {
+                pidfd = Hyprutils::OS::CFileDescriptor{OS::pidfdOpen(pid)};
+
+                if (!pidfd.isValid() && errno == ESRCH)
+                    return;
+
+                if (pidfd.isValid() && g_loop->addFd(pidfd.get(), [this, pApp = a.get(), pid] { onTreeProcessExited(*pApp, pid); }))
+                    ++m_treePidfds;
+                else
+                    pidfd.reset();
+            }
+
+            a->m_tree.emplace_back(CApp::STreeProcess{.pid = pid, .pidfd = std::move(pidfd)});
+            m_treePids.emplace(pid);
+            queue.emplace_back(pid);
+            ++added;
+        };
+
+        // a sandboxed app's pid is inside the sandbox, the shims above it are the app too
+        for (auto proc = m_processes.find(a->m_pid); proc && proc->ppid > 1;) {
+            proc = m_processes.find(proc->ppid);
+
+            if (!proc || !std::ranges::contains(SANDBOX_SHIMS, proc->name()) || KNOWN(proc->pid) || a->m_tree.size() >= MAX_TREE_SIZE)
+                break;
+
+            ADD(proc->pid);
         }
 
-        auto jsonArr = jsonRaw->get_array();
+        // what we know of the tree already is where new processes can come from
+        for (const auto& p : a->m_tree) {
+            if (!std::ranges::contains(queue, p.pid))
+                queue.emplace_back(p.pid);
+        }
 
-        m_apps.reserve(jsonArr.size());
+        for (size_t i = 0; i < queue.size() && a->m_tree.size() < MAX_TREE_SIZE; ++i) {
+            for (const auto& child : m_processes.childrenOf(queue[i])) {
+                if (child.state == 'Z' || KNOWN(child.pid) || a->m_tree.size() >= MAX_TREE_SIZE)
+                    continue;
 
-        for (auto& el : jsonArr) {
-            m_apps.emplace_back(makeUnique<CApp>(el.get_object()));
+                ADD(child.pid);
+            }
         }
     }
 
-    // layers
-    {
-        const auto RET = HyprlandIPC::getFromSocket("j/layers");
+    if (added > 0)
+        g_logger->log(LOG_DEBUG, "Tracking {} more processes in app trees, {} in total", added, m_treePids.size());
+}
 
-        if (!RET) {
-            g_logger->log(LOG_ERR, "Couldn't get layers from socket");
-            return false;
+void CAppState::refreshTrees() {
+    CTraceSpan span("process scan", "state");
+
+    if (!m_processes.snapshot(std::thread::hardware_concurrency())) {
+        g_logger->log(LOG_ERR, "Can't refresh app trees: failed to read the process table");
+        return;
+    }
+
+    span.setCount(sc<int64_t>(m_processes.processes().size()));
+
+    collectTrees();
+}
+
+void CAppState::pruneTrees() {
+    // exits of processes with a pidfd come through g_loop, the ones over MAX_TREE_PIDFDS have to be polled
+    for (const auto& a : m_apps) {
+        std::erase_if(a->m_tree, [this](const auto& p) {
+            if (p.pidfd.isValid() || ::kill(p.pid, 0) == 0 || errno == EPERM)
+                return false;
+
+            m_treePids.erase(p.pid);
+            return true;
+        });
+    }
+}
+
+void CAppState::releaseTree(const CApp& app) {
+    for (const auto& p : app.m_tree) {
+        m_treePids.erase(p.pid);
+
+        if (!p.pidfd.isValid())
+            continue;
+
+        g_loop->removeFd(p.pidfd.get());
+        --m_treePidfds;
+    }
+}
+
+void CAppState::onTreeProcessExited(CApp& app, int64_t pid) {
+    const auto IT = std::ranges::find(app.m_tree, pid, &CApp::STreeProcess::pid);
+
+    if (IT == app.m_tree.end())
+        return;
+
+    g_logger->log(LOG_TRACE, "Process {} of app {} exited", pid, app.m_class);
+
+    // pidfds stay readable after exit
+    g_loop->removeFd(IT->pidfd.get());
+    --m_treePidfds;
+    m_treePids.erase(pid);
+    app.m_tree.erase(IT);
+
+    reconcile();
+}
+
+std::vector<int64_t> CAppState::sparedPids(int64_t compositorPid) const {
+    std::vector<int64_t> spared;
+
+    const auto           ADD_WITH_ANCESTORS = [this, &spared](int64_t pid) {
+        spared.emplace_back(pid);
+        for (auto proc = m_processes.find(pid); proc && proc->ppid > 1 && spared.size() < 128; proc = m_processes.find(proc->ppid)) {
+            spared.emplace_back(proc->ppid);
         }
+    };
 
-        auto jsonRaw = glz::read_json<glz::generic>(*RET);
+    ADD_WITH_ANCESTORS(getpid());
 
-        if (!jsonRaw) {
-            g_logger->log(LOG_ERR, "Socket returned bad data");
-            return false;
+    if (compositorPid > 0)
+        ADD_WITH_ANCESTORS(compositorPid);
+
+    // with everything below them, but a nested compositor below one of them is ours to shut down
+    const auto INSTANCE = HyprlandIPC::currentInstance();
+    const auto OWN      = INSTANCE ? (*INSTANCE)->pid : compositorPid;
+
+    std::vector<int64_t>        queue = m_spared;
+    std::unordered_set<int64_t> seen{queue.begin(), queue.end()};
+
+    for (size_t i = 0; i < queue.size() && queue.size() < MAX_SPARED_SUBTREES; ++i) {
+        for (const auto& child : m_processes.childrenOf(queue[i])) {
+            if (child.pid != OWN && seen.emplace(child.pid).second)
+                queue.emplace_back(child.pid);
+        }
+    }
+
+    spared.insert(spared.end(), queue.begin(), queue.end());
+
+    return spared;
+}
+
+bool CAppState::discoverSessionCgroup(int64_t compositorPid) {
+    const auto ROOT = Cgroup::of(compositorPid);
+
+    if (!ROOT)
+        return false;
+
+    g_logger->log(LOG_DEBUG, "Discovering session processes from cgroup {}", *ROOT);
+
+    // never touch the compositor, ourselves, or whatever launched either
+    const auto EXCLUDED = sparedPids(compositorPid);
+
+    // cgroups holding any of those can't be killed or waited on as a whole
+    std::vector<std::string> excludedCgroups;
+    for (const auto& pid : EXCLUDED) {
+        if (auto cg = Cgroup::of(pid))
+            excludedCgroups.emplace_back(std::move(*cg));
+    }
+
+    const auto ISOLATED = [&excludedCgroups, &ROOT](const std::string& cg) {
+        return cg != *ROOT && std::ranges::none_of(excludedCgroups, [&cg](const auto& ex) { return ex == cg || ex.starts_with(cg + "/"); });
+    };
+
+    // windows and layers are closed through the compositor, and so are their descendants:
+    // a shell in a terminal shouldn't get a SIGTERM before the terminal could ask about it.
+    std::unordered_set<int64_t> owned;
+    for (const auto& a : m_apps) {
+        if (a->m_pid > 0)
+            owned.emplace(a->m_pid);
+    }
+
+    const auto OWNED_BY_APP = [this, &owned](int64_t pid) {
+        size_t depth = 0;
+        for (auto proc = m_processes.find(pid); proc && depth < 64; proc = m_processes.find(proc->ppid), ++depth) {
+            if (owned.contains(proc->pid))
+                return true;
         }
+        return false;
+    };
+
+    std::vector<std::string> usedCgroups;
+
+    for (const auto& CG : Cgroup::subtree(*ROOT)) {
+        const bool CG_ISOLATED = ISOLATED(CG);
 
-        for (auto& [m, obj] : jsonRaw->get_object()) {
-            for (auto& [m2, obj2] : obj["levels"].get_object()) {
-                for (auto& el : obj2.get_array()) {
-                    m_apps.emplace_back(makeUnique<CApp>(el.get_object()));
+        for (const auto& pid : Cgroup::procs(CG)) {
+            if (std::ranges::contains(EXCLUDED, pid))
+                continue;
+
+            if (owned.contains(pid)) {
+                // a window or layer in its own cgroup, wait for all of it
+                for (const auto& a : m_apps) {
+                    if (CG_ISOLATED && a->m_pid == pid)
+                        a->m_cgroup = m_strings.intern(CG);
                 }
+            } else {
+                const auto PROC = m_processes.find(pid);
+
+                if (!PROC || PROC->state == 'Z' || std::ranges::contains(IGNORE_DAEMONS, PROC->name()) || m_treePids.contains(pid) || OWNED_BY_APP(pid))
+                    continue;
+
+                auto& app = addApp(makeUnique<CApp>(PROC->name(), pid, m_strings));
+                if (CG_ISOLATED)
+                    app.m_cgroup = m_strings.intern(CG);
             }
+
+            if (CG_ISOLATED && !std::ranges::contains(usedCgroups, CG))
+                usedCgroups.emplace_back(CG);
         }
+    }
 
-        g_logger->log(LOG_DEBUG, "Parsed {} apps from socket", m_apps.size());
+    for (const auto& cg : usedCgroups) {
+        watchCgroup(cg);
     }
 
-    // children of the Hyprland process
-    // TODO: make a kernel cgroup in hl. This can miss things.
-    // Maybe keep this for BSDs, which don't do cgroups, once we figure out PPid on BSDs.
-    {
-        const auto INSTANCES = HyprlandIPC::instances();
-        const auto HIS       = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+    return true;
+}
 
-        if (HIS && HIS[0] != '\0') {
+void CAppState::watchCgroup(const std::string& path) {
+#if defined(__linux__)
+    if (!m_cgroupWatch.isValid()) {
+        m_cgroupWatch = Hyprutils::OS::CFileDescriptor{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)};
 
-            const HyprlandIPC::SInstanceData* instance = nullptr;
+        if (!m_cgroupWatch.isValid() || !g_loop->addFd(m_cgroupWatch.get(), [this] { onCgroupEvents(); })) {
+            g_logger->log(LOG_ERR, "Couldn't set up inotify for cgroups, waiting on pids instead");
+            m_cgroupWatch.reset();
+            return;
+        }
+    }
 
-            for (const auto& I : INSTANCES) {
-                if (I.id != HIS)
-                    continue;
+    const int WD = inotify_add_watch(m_cgroupWatch.get(), (path + "/cgroup.events").c_str(), IN_MODIFY);
 
-                instance = &I;
-                break;
-            }
+    if (WD < 0) {
+        g_logger->log(LOG_ERR, "Couldn't watch cgroup {}: {}", path, strerror(errno));
+        return;
+    }
 
-            if (!instance)
-                g_logger->log(LOG_ERR, "Can't get children: no instance??");
-            else {
-                // get all processes that have a PPid of us
-                const auto PROCS = OS::getAllPids();
+    m_cgroupWatches[WD] = path;
 
-                for (const auto& pid : PROCS) {
+    for (const auto& a : m_apps) {
+        if (a->m_cgroup != path)
+            continue;
 
-                    // check if child
-                    if (OS::ppidOf(pid) != instance->pid)
-                        continue;
+        // the cgroup has all of it, even what double-forked away
+        a->m_cgroupWatched = true;
+        releaseTree(*a);
+        a->m_tree.clear();
+    }
 
-                    const auto NAME = OS::appNameForPid(pid);
+    // might have emptied before we started watching
+    if (!Cgroup::populated(path))
+        onCgroupEmpty(path);
+#endif
+}
 
-                    if (std::ranges::contains(IGNORE_DAEMONS, NAME))
-                        continue;
+void CAppState::onCgroupEvents() {
+#if defined(__linux__)
+    alignas(inotify_event) char buffer[4096];
+    std::vector<std::string>    emptied;
 
-                    m_apps.emplace_back(makeUnique<CApp>(NAME, pid));
-                }
-            }
+    while (true) {
+        const auto LEN = read(m_cgroupWatch.get(), buffer, sizeof(buffer));
+
+        if (LEN <= 0)
+            break;
 
-        } else
-            g_logger->log(LOG_ERR, "Can't get children: no HIS");
+        for (ssize_t off = 0; off < LEN;) {
+            const auto EV = rc<inotify_event*>(buffer + off);
+            off += sizeof(inotify_event) + EV->len;
+
+            const auto IT = m_cgroupWatches.find(EV->wd);
+            if (IT == m_cgroupWatches.end() || Cgroup::populated(IT->second))
+                continue;
+
+            inotify_rm_watch(m_cgroupWatch.get(), EV->wd);
+            emptied.emplace_back(std::move(IT->second));
+            m_cgroupWatches.erase(IT);
+        }
     }
 
-    // exit them if not dry run
-    if (!m_dryRun) {
-        for (const auto& e : m_apps) {
-            e->quit();
+    for (const auto& cg : emptied) {
+        onCgroupEmpty(cg);
+    }
+
+    if (!emptied.empty())
+        reconcile();
+#endif
+}
+
+void CAppState::onCgroupEmpty(const std::string& path) {
+    g_logger->log(LOG_TRACE, "Cgroup {} is empty", path);
+
+    for (const auto& a : m_apps) {
+        if (a->m_cgroup == path)
+            a->m_exited = true;
+    }
+}
+
+void CAppState::advanceGroups() {
+    const auto BEFORE = m_group;
+
+    while (m_group < Config::GROUP_BACKGROUND && std::ranges::none_of(m_apps, [this](const auto& a) { return a->m_group <= m_group; })) {
+        m_group = sc<Config::eShutdownGroup>(m_group + 1);
+    }
+
+    if (m_groupStarted && m_group == BEFORE)
+        return;
+
+    m_groupStarted = true;
+
+    g_logger->log(LOG_DEBUG, "Shutting down group {}", sc<int>(m_group));
+    g_trace->instant("next group", "escalation", {{"group", sc<int64_t>(m_group)}});
+
+    quitApps();
+}
+
+void CAppState::termApp(CApp& app, std::string_view reason) {
+    if (app.m_pid <= 0) {
+        g_logger->log(LOG_WARN, "CAppState::termApp: app {} has invalid pid {}, skipping SIGTERM", app.m_class, app.m_pid);
+        return;
+    }
+
+    g_logger->log(LOG_TRACE, "CAppState::termApp: SIGTERM for {}, pid {} ({})", app.m_class, app.m_pid, reason);
+    g_trace->instant("sigterm", "escalation", {{"class", app.m_class}, {"pid", app.m_pid}, {"reason", reason}});
+    g_progress->event("signal", {{"id", sc<int64_t>(app.m_id)}, {"class", app.m_class}, {"pid", app.m_pid}, {"signal", "SIGTERM"}, {"reason", reason}});
+
+    if (!app.sendSignal(SIGTERM))
+        g_logger->log(LOG_ERR, "CAppState::termApp: signal failed for pid {}, err: {}", app.m_pid, strerror(errno));
+
+    app.m_stage = CApp::QUIT_TERMED;
+    escalate(app);
+}
+
+void CAppState::killApp(CApp& app) {
+    g_trace->instant("sigkill", "escalation", {{"class", app.m_class}, {"pid", app.m_pid}});
+    g_progress->event("signal", {{"id", sc<int64_t>(app.m_id)}, {"class", app.m_class}, {"pid", app.m_pid}, {"signal", "SIGKILL"}});
+
+    m_wheel.cancel(std::exchange(app.m_escalation, 0));
+
+    // cgroups we have to ourselves go down in one go, including anything we don't know about in them
+    if (!app.m_cgroup.empty() && Cgroup::kill(std::string{app.m_cgroup})) {
+        g_logger->log(LOG_TRACE, "CAppState::killApp: killed cgroup {}", app.m_cgroup);
+
+        for (const auto& a : m_apps) {
+            if (a->m_cgroup != app.m_cgroup)
+                continue;
+
+            m_wheel.cancel(std::exchange(a->m_escalation, 0));
+            a->m_stage = CApp::QUIT_KILLED;
         }
+
+        return;
     }
 
-    return true;
+    app.kill();
+    app.m_stage = CApp::QUIT_KILLED;
+}
+
+void CAppState::escalate(CApp& app) {
+    m_wheel.cancel(std::exchange(app.m_escalation, 0));
+
+    if (m_dryRun)
+        return;
+
+    const auto& ESCALATION = g_config->policyFor(app.m_class);
+    const auto  AFTER      = app.m_stage == CApp::QUIT_CLOSE_REQUESTED ? ESCALATION.term : (app.m_stage == CApp::QUIT_TERMED ? ESCALATION.kill : std::nullopt);
+
+    if (!AFTER)
+        return;
+
+    // forgetApp() cancels this, so the app is still around when it fires
+    app.m_escalation = m_wheel.schedule(*AFTER, [this, pApp = &app] {
+        pApp->m_escalation = 0;
+
+        if (!pApp->appAlive())
+            return;
+
+        if (pApp->m_stage == CApp::QUIT_CLOSE_REQUESTED) {
+            if (pApp->m_hasWindow && !std::exchange(m_blocked, true))
+                m_changed = true;
+
+            termApp(*pApp, "term timeout");
+        } else if (pApp->m_stage == CApp::QUIT_TERMED)
+            killApp(*pApp);
+    });
+}
+
+void CAppState::scheduleReclose() {
+    m_wheel.schedule(g_config->recloseInterval(), [this] {
+        reexitApps();
+        scheduleReclose();
+    });
+}
+
+void CAppState::scheduleStuckCheck(CApp& app) {
+    if (app.m_stuckCheck || app.m_stuck || app.m_stage == CApp::QUIT_KILLED)
+        return;
+
+    // past its own p99, or the reclose interval for classes we don't know yet
+    const auto AFTER = std::max<std::chrono::milliseconds>(m_history.p99(app.m_class).value_or(g_config->recloseInterval()), MIN_STUCK_AFTER);
+
+    // forgetApp() cancels this too
+    app.m_stuckCheck = m_wheel.schedule(AFTER, [this, pApp = &app, AFTER] {
+        pApp->m_stuckCheck = 0;
+
+        if (!pApp->appAlive() || pApp->m_stage == CApp::QUIT_KILLED)
+            return;
+
+        g_logger->log(LOG_DEBUG, "App {} with pid {} is stuck, still alive after {}ms", pApp->m_class, pApp->m_pid, AFTER.count());
+        g_trace->instant("stuck", "escalation", {{"class", pApp->m_class}, {"pid", pApp->m_pid}});
+        g_progress->event("stuck", {{"id", sc<int64_t>(pApp->m_id)}, {"class", pApp->m_class}, {"after_ms", sc<int64_t>(AFTER.count())}});
+
+        pApp->m_stuck = true;
+        m_blocked     = true;
+        m_changed     = true;
+    });
+}
+
+void CAppState::markQuitSent(CApp& app) {
+    if (app.m_quitSent)
+        return;
+
+    app.m_quitSent = std::chrono::steady_clock::now();
+    g_trace->asyncBegin(app.m_class, "app", app.m_id, *app.m_quitSent, {{"pid", app.m_pid}});
 }
 
 const std::vector<UP<CApp>>& CAppState::apps() const {
     return m_apps;
 }
 
+bool CAppState::blocked() const {
+    return m_blocked;
+}
+
+std::optional<float> CAppState::secondsLeft() const {
+    const auto                               NOW = std::chrono::steady_clock::now();
+    std::optional<std::chrono::milliseconds> left;
+
+    for (const auto& a : m_apps) {
+        if (!a->m_quitSent)
+            continue;
+
+        const auto EXPECTED = m_history.median(a->m_class);
+        if (!EXPECTED)
+            continue;
+
+        const auto LEFT = *EXPECTED - std::chrono::duration_cast<std::chrono::milliseconds>(NOW - *a->m_quitSent);
+        left            = std::max(left.value_or(LEFT), LEFT);
+    }
+
+    // overdue isn't a prediction anymore
+    if (!left || left->count() <= 0)
+        return std::nullopt;
+
+    return left->count() / 1000.F;
+}
+
+void CAppState::saveHistory() {
+    m_history.save();
+}
+
 float CAppState::secondsPassed() const {
     return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_started).count() / 1000.F;
 }
 
-bool CAppState::updateState() {
-    const auto RET = HyprlandIPC::getFromSocket("j/clients");
+void CAppState::resync() {
+    if (m_resyncRequest && !m_resyncRequest->done())
+        return; // previous one still in flight
 
-    if (!RET) {
-        g_logger->log(LOG_ERR, "Couldn't get clients from socket");
+    m_resyncRequest = HyprlandIPC::request("j/clients", [this](std::expected<std::string_view, std::string>&& ret) {
+        if (!ret) {
+            g_logger->log(LOG_ERR, "Couldn't get clients from socket: {}", ret.error());
+            return;
+        }
+
+        if (applyClients(*ret))
+            reconcile();
+    });
+}
+
+bool CAppState::applyClients(std::string_view json) {
+    // m_clients keeps its elements between resyncs, so their strings are reused too
+    if (const auto ERR = glz::read<HyprlandIPC::JSON_OPTS>(m_clients, json); ERR) {
+        g_logger->log(LOG_ERR, "Socket returned bad data: {}", glz::format_error(ERR, json));
         return false;
     }
 
-    auto jsonRaw = glz::read_json<glz::generic>(*RET);
+    m_lastResync = std::chrono::steady_clock::now();
 
-    if (!jsonRaw) {
-        g_logger->log(LOG_ERR, "Socket returned bad data");
-        return false;
+    for (const auto& app : m_apps) {
+        app->m_hasWindow = false;
     }
 
-    auto       table = jsonRaw->get_array();
+    m_apps.reserve(m_apps.size() + m_clients.size());
+
+    for (const auto& client : m_clients) {
+        const auto ADDR = parseAddress(client.address);
+        const auto IT   = ADDR ? m_byAddress.find(*ADDR) : m_byAddress.end();
+
+        if (IT == m_byAddress.end()) {
+            // a window we missed an openwindow for
+            addApp(makeUnique<CApp>(client, m_strings));
+            m_changed = true;
+            continue;
+        }
+
+        auto& app       = *IT->second;
+        app.m_hasWindow = true;
+
+        // windows from openwindow don't carry a pid
+        if (app.m_pid <= 0 && client.pid > 0) {
+            app.m_pid = client.pid;
+            m_byPid.emplace(app.m_pid, &app);
+            watchApp(app);
+        }
+    }
 
+    return true;
+}
+
+void CAppState::updateState() {
+    if (m_eventSocket.fd() < 0 || std::chrono::steady_clock::now() - m_lastResync > RESYNC_INTERVAL)
+        resync();
+
+    reconcile();
+}
+
+void CAppState::reconcile() {
     const auto BEFORE = m_apps.size();
 
-    std::erase_if(m_apps, [&table](const auto& e) { return !e->appAlive() && !std::ranges::any_of(table, [&e](const auto& te) { return te == *e; }); });
+    pruneTrees();
+    removeDeadApps();
+
+    if (m_groupStarted && !m_dryRun)
+        advanceGroups();
 
-    // check PIDs
-    if (!m_dryRun) {
+    // check PIDs. A resident registry leaves everything alone until the shutdown begins.
+    if (!m_dryRun && m_groupStarted) {
         for (const auto& app : m_apps) {
-            if (!app->appAlive() || app->m_pid <= 0 || app->m_address.empty() /* not a window */ || std::ranges::contains(m_pidsTermedNoWindows, app->m_pid))
+            // layers have an address too, but they and later groups wait for their turn
+            if (app->m_alwaysUsePid || app->m_group != m_group)
                 continue;
 
-            const bool HAS_ANY_WINDOWS = std::ranges::any_of(table, [&app](const auto& te) {
-                if (!te.contains("pid"))
-                    return false;
+            if (!app->appAlive() || app->m_pid <= 0 || !app->m_address /* not a window */ || m_pidsTermedNoWindows.contains(app->m_pid))
+                continue;
 
-                return sc<int>(te["pid"].get_number()) == app->m_pid;
-            });
+            const auto [FIRST, LAST]   = m_byPid.equal_range(app->m_pid);
+            const bool HAS_ANY_WINDOWS = std::any_of(FIRST, LAST, [](const auto& e) { return e.second->m_hasWindow; });
 
             if (HAS_ANY_WINDOWS)
                 continue;
 
-            // app has no windows, but is alive. Send a SIGTERM.
-            // TODO: maybe make this also repeat every 5s or so?
-            m_pidsTermedNoWindows.emplace_back(app->m_pid);
+            // app has no windows, but is alive. Send a SIGTERM, reexitApps() repeats it.
+            m_pidsTermedNoWindows.emplace(app->m_pid);
 
-            g_logger->log(LOG_DEBUG, "App {} with pid {} window was closed, but pid is alive. Sending SIGTERM.", app->m_class, app->m_pid);
-            kill(app->m_pid, SIGTERM);
+            g_logger->log(LOG_DEBUG, "App {} with pid {} window was closed, but pid is alive.", app->m_class, app->m_pid);
+            termApp(*app, "window closed");
         }
     }
 
     g_logger->log(LOG_DEBUG, "Updated state: apps size {}", m_apps.size());
 
-    return BEFORE != m_apps.size();
+    if (BEFORE != m_apps.size() || std::exchange(m_changed, false)) {
+        g_trace->counter("apps", sc<int64_t>(m_apps.size()));
+        m_events.changed.emit();
+    }
+}
+
+CApp& CAppState::addApp(UP<CApp>&& app) {
+    auto& ref = *m_apps.emplace_back(std::move(app));
+
+    if (const auto GROUP = g_config->policyFor(ref.m_class).group; GROUP)
+        ref.m_group = *GROUP;
+
+    // layers have addresses too, but never show up in j/clients
+    if (!ref.m_alwaysUsePid && ref.m_address)
+        m_byAddress[ref.m_address] = &ref;
+
+    if (ref.m_pid > 0)
+        m_byPid.emplace(ref.m_pid, &ref);
+
+    if (g_progress->enabled()) {
+        const std::string_view KIND = ref.m_alwaysUsePid ? "layer" : (!ref.m_address ? "process" : "window");
+        g_progress->event("app_discovered", {{"id", sc<int64_t>(ref.m_id)}, {"class", ref.m_class}, {"pid", ref.m_pid}, {"kind", KIND}});
+    }
+
+    watchApp(ref);
+    return ref;
 }
 
-void CAppState::killAllApps() const {
+void CAppState::forgetApp(const CApp& app) {
+    m_wheel.cancel(app.m_escalation);
+    m_wheel.cancel(app.m_stuckCheck);
+    releaseTree(app);
+
+    if (app.m_quitSent)
+        g_trace->asyncEnd(app.m_class, "app", app.m_id, CTrace::Clock::now());
+
+    // -1 if it went away on its own, before we asked
+    const auto ELAPSED = app.m_quitSent ? std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - *app.m_quitSent).count() : -1;
+    g_progress->event("app_exited", {{"id", sc<int64_t>(app.m_id)}, {"class", app.m_class}, {"elapsed_ms", sc<int64_t>(ELAPSED)}});
+
+    // a SIGKILL only says how long the kill timeout is
+    if (app.m_stage == CApp::QUIT_CLOSE_REQUESTED || app.m_stage == CApp::QUIT_TERMED)
+        m_history.record(app.m_class, std::chrono::milliseconds(ELAPSED));
+
+    if (const auto IT = m_byAddress.find(app.m_address); IT != m_byAddress.end() && IT->second == &app)
+        m_byAddress.erase(IT);
+
+    const auto [FIRST, LAST] = m_byPid.equal_range(app.m_pid);
+    for (auto it = FIRST; it != LAST; ++it) {
+        if (it->second != &app)
+            continue;
+
+        m_byPid.erase(it);
+        break;
+    }
+}
+
+void CAppState::watchApp(CApp& app) {
+    if (!app.openPidfd())
+        return;
+
+    if (!g_loop->addFd(app.m_pidfd.get(), [this, pApp = &app] { onAppExited(*pApp); }))
+        app.m_pidfd.reset(); // fall back to kill(pid, 0)
+}
+
+void CAppState::onAppExited(CApp& app) {
+    g_logger->log(LOG_TRACE, "App {} with pid {} exited", app.m_class, app.m_pid);
+
+    // pidfds stay readable after exit
+    g_loop->removeFd(app.m_pidfd.get());
+    app.m_pidfd.reset();
+    app.m_pidExited = true;
+
+    // its cgroup tells us when everything else is gone too
+    if (app.m_cgroupWatched)
+        return;
+
+    app.m_exited = true;
+
+    reconcile();
+}
+
+bool CAppState::removeDeadApps() {
+    return std::erase_if(m_apps, [this](const auto& e) {
+               if (e->appAlive() || e->m_hasWindow)
+                   return false;
+
+               forgetApp(*e);
+               return true;
+           }) > 0;
+}
+
+void CAppState::onEventSocket() {
+    bool       relevant = false;
+
+    const auto FD    = m_eventSocket.fd();
+    const bool ALIVE = m_eventSocket.dispatch([this, &relevant](std::string_view name, std::string_view data) { relevant = onEvent(name, data) || relevant; });
+
+    if (!ALIVE) {
+        g_logger->log(LOG_WARN, "Event socket closed, falling back to polling");
+        g_loop->removeFd(FD);
+        m_eventSocket.close();
+    }
+
+    if (relevant)
+        reconcile();
+}
+
+bool CAppState::onEvent(std::string_view name, std::string_view data) {
+    if (name == "openwindow") {
+        // ADDRESS,WORKSPACE,CLASS,TITLE. Title can contain commas.
+        const auto COMMA1 = data.find(',');
+        const auto COMMA2 = COMMA1 == std::string_view::npos ? std::string_view::npos : data.find(',', COMMA1 + 1);
+        const auto COMMA3 = COMMA2 == std::string_view::npos ? std::string_view::npos : data.find(',', COMMA2 + 1);
+
+        if (COMMA3 == std::string_view::npos)
+            return false;
+
+        const auto ADDR = parseAddress(data.substr(0, COMMA1));
+
+        if (!ADDR || m_byAddress.contains(*ADDR))
+            return false;
+
+        g_logger->log(LOG_DEBUG, "Window 0x{:x} opened during shutdown", *ADDR);
+
+        if (m_groupStarted)
+            m_blocked = true;
+
+        addApp(makeUnique<CApp>(*ADDR, data.substr(COMMA2 + 1, COMMA3 - COMMA2 - 1), data.substr(COMMA3 + 1), m_strings));
+        m_changed = true;
+        return true;
+    }
+
+    if (name == "closewindow") {
+        const auto ADDR = parseAddress(data);
+        const auto IT   = ADDR ? m_byAddress.find(*ADDR) : m_byAddress.end();
+
+        if (IT != m_byAddress.end())
+            IT->second->m_hasWindow = false;
+
+        return true;
+    }
+
+    // layers are tracked by their pid, just check liveness
+    return name == "closelayer";
+}
+
+void CAppState::killAllApps() {
     if (m_dryRun) {
         g_logger->log(LOG_TRACE, "CAppState::killAllApps: ignoring, dry run");
         return;
     }
 
+    g_trace->instant("force kill", "escalation", {{"apps", sc<int64_t>(m_apps.size())}});
+
+    // a pid can't be opened safely anymore once it's dead
+    std::vector<Hyprutils::OS::CFileDescriptor> owned;
+    const auto                                  VICTIMS = killVictims(owned);
+
     for (const auto& a : m_apps) {
-        a->kill();
+        // might have gone down with an earlier one's cgroup
+        if (a->m_stage != CApp::QUIT_KILLED)
+            killApp(*a);
     }
+
+    reclaimMemory(VICTIMS);
 }
 
-void CAppState::reexitApps() const {
+std::vector<int> CAppState::killVictims(std::vector<Hyprutils::OS::CFileDescriptor>& owned) {
+    std::vector<int>            pidfds;
+    std::unordered_set<int64_t> seen;
+
+    const auto                  ADD = [&pidfds, &owned, &seen](int64_t pid, const Hyprutils::OS::CFileDescriptor& pidfd) {
+        if (pid <= 0 || !seen.emplace(pid).second)
+            return;
+
+        if (pidfd.isValid()) {
+            pidfds.emplace_back(pidfd.get());
+            return;
+        }
+
+        if (auto fd = Hyprutils::OS::CFileDescriptor{OS::pidfdOpen(pid)}; fd.isValid())
+            pidfds.emplace_back(owned.emplace_back(std::move(fd)).get());
+    };
+
+    std::vector<std::string_view> cgroups;
+
+    for (const auto& a : m_apps) {
+        if (!a->m_exited && !a->m_pidExited)
+            ADD(a->m_pid, a->m_pidfd);
+
+        for (const auto& p : a->m_tree) {
+            ADD(p.pid, p.pidfd);
+        }
+
+        // cgroup.kill also takes what we never saw
+        if (!a->m_cgroup.empty() && !std::ranges::contains(cgroups, a->m_cgroup)) {
+            cgroups.emplace_back(a->m_cgroup);
+
+            for (const auto& pid : Cgroup::procs(std::string{a->m_cgroup})) {
+                ADD(pid, {});
+            }
+        }
+    }
+
+    return pidfds;
+}
+
+void CAppState::reclaimMemory(const std::vector<int>& pidfds) {
+    if (pidfds.empty())
+        return;
+
+    // each call blocks until that process's memory is gone, so they run side by side
+    const auto          START   = CTrace::Clock::now();
+    const size_t        THREADS = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, pidfds.size());
+
+    std::atomic<size_t> next     = 0;
+    std::atomic<size_t> released = 0;
+
+    {
+        std::vector<std::jthread> workers;
+        workers.reserve(THREADS);
+
+        for (size_t i = 0; i < THREADS; ++i) {
+            workers.emplace_back([&pidfds, &next, &released] {
+                for (size_t idx = next++; idx < pidfds.size(); idx = next++) {
+                    if (OS::processMrelease(pidfds[idx]))
+                        ++released;
+                }
+            });
+        }
+    }
+
+    const auto END = CTrace::Clock::now();
+    const auto MS  = std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count();
+
+    g_logger->log(LOG_DEBUG, "Reclaimed the memory of {} of {} killed processes in {}ms", released.load(), pidfds.size(), MS);
+    g_trace->complete("reclaim memory", "escalation", START, END, {{"count", sc<int64_t>(released.load())}});
+    g_progress->event("memory_reclaimed", {{"processes", sc<int64_t>(released.load())}, {"elapsed_ms", sc<int64_t>(MS)}});
+}
+
+void CAppState::reexitApps() {
     if (m_dryRun) {
         g_logger->log(LOG_TRACE, "CAppState::reexitApps: ignoring, dry run");
         return;
     }
 
+    g_logger->log(LOG_DEBUG, "Re-closing apps");
+    g_trace->instant("re-close apps", "escalation");
+
+    // apps may have started helpers since
+    refreshTrees();
+
+    quitApps();
+}
+
+void CAppState::quitApps(bool onlyNew) {
+    // windows get closed in one batch, everything else is signalled right away
+    std::vector<std::string>      cmds;
+    // interned, they outlive the request
+    std::vector<std::string_view> classes;
+
+    // apps that usually take long go first, so they don't also wait on the rest of the batch
+    std::vector<std::pair<int64_t, CApp*>> order;
+    order.reserve(m_apps.size());
     for (const auto& a : m_apps) {
-        a->quit();
+        order.emplace_back(m_history.median(a->m_class).value_or(std::chrono::milliseconds(0)).count(), a.get());
     }
+
+    std::ranges::stable_sort(order, std::greater{}, [](const auto& e) { return e.first; });
+
+    std::vector<CApp*> asked;
+
+    for (const auto& [expected, a] : order) {
+        // its turn comes once the groups before it are done
+        if (a->m_group > m_group || (onlyNew && a->m_stage != CApp::QUIT_NONE))
+            continue;
+
+        markQuitSent(*a);
+        asked.emplace_back(a);
+
+        // past asking nicely, but SIGTERM can be repeated
+        if (a->m_stage == CApp::QUIT_KILLED)
+            continue;
+
+        if (a->m_stage == CApp::QUIT_TERMED) {
+            a->sendSignal(SIGTERM);
+            continue;
+        }
+
+        // for apps that have an address, use closewindow. Some apps don't ask for saving on SIGTERM
+        if (!a->closesByWindow()) {
+            termApp(*a, "no window");
+            continue;
+        }
+
+        if (!a->m_address) {
+            g_logger->log(LOG_WARN, "CAppState::quitApps: app {} has no address and no valid pid, skipping", a->m_class);
+            continue;
+        }
+
+        if (a->m_stage == CApp::QUIT_NONE) {
+            a->m_stage = CApp::QUIT_CLOSE_REQUESTED;
+            escalate(*a);
+            g_progress->event("close_requested", {{"id", sc<int64_t>(a->m_id)}, {"class", a->m_class}});
+        }
+
+        cmds.emplace_back(a->closeCommand());
+        classes.emplace_back(a->m_class);
+    }
+
+    // after the escalations, they're the deadlines that matter
+    for (const auto& a : asked) {
+        scheduleStuckCheck(*a);
+    }
+
+    if (cmds.empty())
+        return;
+
+    g_logger->log(LOG_TRACE, "CAppState::quitApps: closing {} windows in a batch", cmds.size());
+
+    HyprlandIPC::requestBatch(cmds, [classes = std::move(classes)](std::expected<std::vector<std::string_view>, std::string>&& ret) {
+        if (!ret) {
+            g_logger->log(LOG_ERR, "Failed closing {} windows: {}", classes.size(), ret.error());
+            return;
+        }
+
+        for (size_t i = 0; i < classes.size(); ++i) {
+            if ((*ret)[i] != "ok")
+                g_logger->log(LOG_ERR, "Failed closing window {}: {}", classes[i], (*ret)[i]);
+        }
+    });
 }
@@ -1,35 +1,102 @@
 #pragma once
 
 #include "../helpers/Memory.hpp"
+#include "../helpers/OS.hpp"
+#include "../helpers/TimerWheel.hpp"
+#include "../helpers/StringPool.hpp"
+#include "../config/ConfigManager.hpp"
+#include "HyprlandIPC.hpp"
+#include "IPCReplies.hpp"
+#include "History.hpp"
 
-#include <glaze/glaze.hpp>
+#include <hyprutils/signal/Signal.hpp>
 
 #include <chrono>
 #include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace State {
     class CApp {
       public:
-        CApp(glz::generic::object_t& object);
-        CApp(const std::string& name, int pid);
-        ~CApp() = default;
+        CApp(const HyprlandIPC::SClient& client, CStringPool& strings);
+        CApp(const HyprlandIPC::SLayer& layer, CStringPool& strings);
+        CApp(std::string_view name, int pid, CStringPool& strings);
+        CApp(uint64_t address, std::string_view clazz, std::string_view title, CStringPool& strings);
+        ~CApp();
 
         CApp(const CApp&) = delete;
         CApp(CApp&)       = delete;
         CApp(CApp&&)      = delete;
 
         bool        appAlive() const;
-        bool        operator==(const glz::generic& object) const;
 
-        void        quit();
         void        kill();
+        // to the app and every process in its tree. If none got it, errno is from the first that failed.
+        bool        sendSignal(int sig);
+        bool        closesByWindow() const;
+        std::string closeCommand() const;
+        bool        openPidfd();
+
+        // how far the shutdown got with this app. Each step has a deadline from the config, see escalate().
+        enum eQuitStage : uint8_t {
+            QUIT_NONE = 0,
+            QUIT_CLOSE_REQUESTED,
+            QUIT_TERMED,
+            QUIT_KILLED,
+        };
+
+        // unique for the run and increasing, apps are kept in creation order
+        const uint64_t                 m_id = nextId();
+
+        // what reconcile() and appAlive() look at on every pass, kept together at the front
+        // window address, 0 for none. Layers have one too, but are closed by pid.
+        uint64_t                       m_address = 0;
+        int64_t                        m_pid     = -1;
+        // valid when the exit is watched on g_loop, so appAlive() doesn't poll
+        Hyprutils::OS::CFileDescriptor m_pidfd;
+        eQuitStage                     m_stage        = QUIT_NONE;
+        Config::eShutdownGroup         m_group        = Config::GROUP_WINDOWS;
+        bool                           m_hasWindow    = false;
+        bool                           m_exited       = false;
+        bool                           m_alwaysUsePid = false;
+        bool                           m_xwayland     = false;
+        // set if the app has a cgroup to itself. It's then alive until the cgroup is empty.
+        bool                           m_cgroupWatched = false;
+        // m_pid's pidfd reported its exit, the pid may be someone else's by now. Apart from m_exited for cgroup watched apps.
+        bool                           m_pidExited = false;
+        bool                           m_stuck     = false;
+
+        // interned in CAppState, classes and cgroups repeat a lot. Empty if unknown.
+        std::string_view               m_class;
+        std::string_view               m_cgroup;
+        // titles hardly ever repeat, the pool would only grow with them in --daemon
+        std::string                    m_title;
+
+        // when we first asked it to quit
+        std::optional<std::chrono::steady_clock::time_point> m_quitSent;
+
+        // CTimerWheel handle of the next step, 0 if none
+        uint64_t                       m_escalation = 0;
+        // and of the check whether it's taking longer than its class usually does
+        uint64_t                       m_stuckCheck = 0;
+
+        // helpers, renderers and sandbox shims around m_pid. The app is alive until all of them are gone too.
+        // Apps that have their cgroup watched don't need one.
+        struct STreeProcess {
+            int64_t                        pid = -1;
+            // on g_loop. Invalid if it couldn't be opened or there are too many, it's then signalled and polled by pid
+            Hyprutils::OS::CFileDescriptor pidfd;
+        };
+
+        std::vector<STreeProcess>      m_tree;
 
-        std::string m_address;
-        std::string m_title;
-        std::string m_class;
-        int64_t     m_pid          = -1;
-        bool        m_xwayland     = false;
-        bool        m_alwaysUsePid = false;
+      private:
+        static uint64_t nextId();
     };
 
     class CAppState {
@@ -44,20 +111,113 @@ namespace State {
         CAppState(CAppState&&)      = delete;
 
         bool                         init();
-        bool                         updateState();
+        // starts closing apps. init() does so itself, unless m_resident.
+        void                         beginShutdown();
+        // liveness checks and a j/clients resync when due. Changes are reported through m_events.
+        void                         updateState();
         float                        secondsPassed() const;
-        void                         killAllApps() const;
-        void                         reexitApps() const;
+        void                         killAllApps();
+        // close requests and SIGTERMs again, for apps that didn't react yet
+        void                         reexitApps();
 
         const std::vector<UP<CApp>>& apps() const;
+        // something is holding the shutdown up: a window opened while closing (likely a save prompt),
+        // a window didn't close before its term timeout, or an app takes longer than it ever did
+        bool                         blocked() const;
+        // until the last app that was asked should be gone, going by the exit times of its class. nullopt if unknown.
+        std::optional<float>         secondsLeft() const;
+        // the exit times of this run, for the next ones
+        void                         saveHistory();
 
         bool                         m_dryRun = false;
+        // off where the "compositor" shares its cgroup with everything else, like the benchmark
+        bool                         m_useCgroups = true;
+        // --daemon: init() only builds the registry, which events keep current until beginShutdown()
+        bool                         m_resident = false;
+        // --all-instances: the other workers and compositors. They and everything below them are never signalled.
+        std::vector<int64_t>         m_spared;
+
+        struct {
+            Hyprutils::Signal::CSignalT<> changed;
+        } m_events;
 
       private:
+        void                                  resync();
+        bool                                  applyClients(std::string_view json);
+        void                                  reconcile();
+        void                                  onEventSocket();
+        bool                                  onEvent(std::string_view name, std::string_view data);
+        CApp&                                 addApp(UP<CApp>&& app);
+        void                                  forgetApp(const CApp& app);
+        void                                  watchApp(CApp& app);
+        void                                  onAppExited(CApp& app);
+        bool                                  removeDeadApps();
+        // starts the windows group, if there is anything in it, before the rest of the session is known
+        void                                  closeWindowsEarly();
+        void                                  discoverChildren();
+        bool                                  discoverSessionCgroup(int64_t compositorPid);
+        // adds what m_processes has of every app's tree, exited processes were reparented away already
+        void                                  collectTrees();
+        // re-reads the process table for collectTrees()
+        void                                  refreshTrees();
+        // polls what has no pidfd
+        void                                  pruneTrees();
+        // forgets the tree's pids and takes its pidfds off g_loop
+        void                                  releaseTree(const CApp& app);
+        void                                  onTreeProcessExited(CApp& app, int64_t pid);
+        // never signalled or waited on: ourselves, and the compositor if given, with whatever launched them, and m_spared
+        std::vector<int64_t>                  sparedPids(int64_t compositorPid = -1) const;
+        void                                  watchCgroup(const std::string& path);
+        void                                  onCgroupEvents();
+        void                                  onCgroupEmpty(const std::string& path);
+        // starts the first group with anything in it, or the next once the current one is done
+        void                                  advanceGroups();
+        // onlyNew skips apps that were asked already
+        void                                  quitApps(bool onlyNew = false);
+        void                                  termApp(CApp& app, std::string_view reason);
+        void                                  killApp(CApp& app);
+        // pidfds of everything killAllApps() is about to kill, temporary ones go into owned
+        std::vector<int>                      killVictims(std::vector<Hyprutils::OS::CFileDescriptor>& owned);
+        static void                           reclaimMemory(const std::vector<int>& pidfds);
+        void                                  escalate(CApp& app);
+        void                                  scheduleReclose();
+        void                                  scheduleStuckCheck(CApp& app);
+        static void                           markQuitSent(CApp& app);
+
+        // before m_apps, so it outlives the views into it
+        CStringPool                           m_strings;
         std::vector<UP<CApp>>                 m_apps;
-        std::vector<int>                      m_pidsTermedNoWindows;
+        std::unordered_set<int64_t>           m_pidsTermedNoWindows;
+        // everything in some app's m_tree
+        std::unordered_set<int64_t>           m_treePids;
+        // how many of those have a pidfd on g_loop
+        size_t                                m_treePidfds = 0;
+        bool                                  m_changed = false;
+        bool                                  m_blocked = false;
+        std::vector<HyprlandIPC::SClient>     m_clients;
+
+        // lookups for events and resyncs. Point into m_apps.
+        std::unordered_map<uint64_t, CApp*>     m_byAddress;
+        std::unordered_multimap<int64_t, CApp*> m_byPid;
+
+        HyprlandIPC::CEventSocket               m_eventSocket;
+        SP<HyprlandIPC::CRequest>               m_resyncRequest;
+
+        OS::CProcessTable                       m_processes;
+        CExitHistory                            m_history;
+
+        Hyprutils::OS::CFileDescriptor          m_cgroupWatch;
+        std::unordered_map<int, std::string>    m_cgroupWatches;
+
+        std::chrono::steady_clock::time_point   m_started = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point   m_lastResync;
+
+        // escalation deadlines and re-closing
+        CTimerWheel                             m_wheel{std::chrono::milliseconds(50), 256};
 
-        std::chrono::steady_clock::time_point m_started = std::chrono::steady_clock::now();
+        // the group being shut down, everything before it is gone
+        Config::eShutdownGroup                  m_group        = Config::GROUP_WINDOWS;
+        bool                                    m_groupStarted = false;
     };
 
     SP<CAppState> state();
@@ -0,0 +1,213 @@
+#include "Daemon.hpp"
+#include "AppState.hpp"
+#include "HyprlandIPC.hpp"
+#include "../helpers/Logger.hpp"
+#include "../helpers/Trace.hpp"
+#include "../helpers/Progress.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <hyprutils/memory/Casts.hpp>
+
+using namespace Hyprutils::Memory;
+
+constexpr std::string_view TRIGGER_REQUEST = "shutdown";
+// answered, but changes nothing. Tells a live daemon from a stale socket.
+constexpr std::string_view PING_REQUEST = "ping";
+constexpr std::string_view REPLY        = "ok";
+// while idle, j/clients catches what the events missed
+constexpr auto             REFRESH_INTERVAL = std::chrono::seconds(10);
+// either side gives up on the other after this
+constexpr auto             SOCKET_TIMEOUT = timeval{.tv_sec = 1, .tv_usec = 0};
+
+static std::optional<std::string> socketPath() {
+    const auto INSTANCE = HyprlandIPC::currentInstance();
+
+    if (!INSTANCE)
+        return std::nullopt;
+
+    return (*INSTANCE)->dir + "/.hyprshutdown.sock";
+}
+
+static sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address = {0};
+    address.sun_family  = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// true if a daemon answered
+static bool sendRequest(std::string_view request) {
+    const auto PATH = socketPath();
+
+    if (!PATH)
+        return false;
+
+    auto fd = Hyprutils::OS::CFileDescriptor{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+
+    if (!fd.isValid())
+        return false;
+
+    setsockopt(fd.get(), SOL_SOCKET, SO_RCVTIMEO, &SOCKET_TIMEOUT, sizeof(SOCKET_TIMEOUT));
+
+    auto address = socketAddress(*PATH);
+
+    if (connect(fd.get(), rc<sockaddr*>(&address), SUN_LEN(&address)) < 0)
+        return false;
+
+    if (write(fd.get(), request.data(), request.size()) != sc<ssize_t>(request.size()))
+        return false;
+
+    char       buffer[8];
+    const auto LEN = read(fd.get(), buffer, sizeof(buffer));
+
+    return LEN > 0 && std::string_view{buffer, sc<size_t>(LEN)} == REPLY;
+}
+
+CDaemon::~CDaemon() {
+    // pending timeouts would call into us
+    for (const auto& [fd, client] : m_clients) {
+        client.timeout->cancel();
+    }
+
+    // g_loop may be gone already at exit, closing the sockets drops them from epoll anyway
+    if (m_socket.isValid())
+        unlink(m_path.c_str());
+}
+
+bool CDaemon::listen() {
+    const auto PATH = socketPath();
+
+    if (!PATH) {
+        g_logger->log(LOG_ERR, "CDaemon: no Hyprland instance to listen for");
+        return false;
+    }
+
+    // a socket nobody answers on is left over from a daemon that died
+    if (sendRequest(PING_REQUEST)) {
+        g_logger->log(LOG_ERR, "CDaemon: another daemon already runs for this instance");
+        return false;
+    }
+
+    unlink(PATH->c_str());
+
+    m_socket = Hyprutils::OS::CFileDescriptor{socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+
+    if (!m_socket.isValid())
+        return false;
+
+    auto address = socketAddress(*PATH);
+
+    if (bind(m_socket.get(), rc<sockaddr*>(&address), SUN_LEN(&address)) < 0 || ::listen(m_socket.get(), 8) < 0) {
+        g_logger->log(LOG_ERR, "CDaemon: couldn't listen on {}: {}", *PATH, strerror(errno));
+        m_socket.reset();
+        return false;
+    }
+
+    m_path = *PATH;
+
+    g_loop->addFd(m_socket.get(), [this] { onConnection(); });
+
+    scheduleRefresh();
+
+    g_logger->log(LOG_DEBUG, "Waiting for --trigger on {}", m_path);
+
+    return true;
+}
+
+void CDaemon::waitForTrigger() {
+    while (!m_triggered) {
+        g_loop->enterLoop();
+    }
+}
+
+bool CDaemon::triggered() const {
+    return m_triggered;
+}
+
+void CDaemon::scheduleRefresh() {
+    m_refreshTimer = g_loop->addTimer(REFRESH_INTERVAL, [this] {
+        State::state()->updateState();
+        scheduleRefresh();
+    });
+}
+
+void CDaemon::onConnection() {
+    auto client = Hyprutils::OS::CFileDescriptor{accept4(m_socket.get(), nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)};
+
+    if (!client.isValid())
+        return;
+
+    const auto FD = client.get();
+
+    // a client that connects and never writes doesn't hold anything up
+    auto timeout = g_loop->addTimer(std::chrono::seconds(SOCKET_TIMEOUT.tv_sec), [this, FD] {
+        g_logger->log(LOG_DEBUG, "CDaemon: client sent nothing, dropping it");
+        dropClient(FD);
+    });
+
+    if (!g_loop->addFd(FD, [this, FD] { onClientReadable(FD); })) {
+        timeout->cancel();
+        return;
+    }
+
+    m_clients.emplace(FD, SClient{.fd = std::move(client), .timeout = std::move(timeout)});
+}
+
+void CDaemon::dropClient(int fd) {
+    const auto IT = m_clients.find(fd);
+
+    if (IT == m_clients.end())
+        return;
+
+    g_loop->removeFd(fd);
+    IT->second.timeout->cancel();
+    m_clients.erase(IT);
+}
+
+void CDaemon::onClientReadable(int fd) {
+    // requests are a single short write, sent right after connecting
+    char       buffer[32];
+    const auto LEN = read(fd, buffer, sizeof(buffer));
+
+    if (LEN < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (LEN <= 0) {
+        dropClient(fd);
+        return;
+    }
+
+    // a couple of bytes into an empty socket buffer, this doesn't come back short
+    if (write(fd, REPLY.data(), REPLY.size()) != sc<ssize_t>(REPLY.size()))
+        g_logger->log(LOG_WARN, "CDaemon: couldn't reply to a client: {}", strerror(errno));
+
+    dropClient(fd);
+
+    if (std::string_view{buffer, sc<size_t>(LEN)} != TRIGGER_REQUEST || std::exchange(m_triggered, true))
+        return;
+
+    g_logger->log(LOG_DEBUG, "Triggered, shutting down");
+    g_trace->instant("trigger", "escalation");
+    g_progress->event("triggered");
+
+    if (m_refreshTimer)
+        m_refreshTimer->cancel();
+
+    State::state()->beginShutdown();
+
+    m_events.triggered.emit();
+    g_loop->leaveLoop();
+}
+
+bool CDaemon::trigger() {
+    return sendRequest(TRIGGER_REQUEST);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include <hyprutils/os/FileDescriptor.hpp>
+#include <hyprutils/signal/Signal.hpp>
+
+#include "../helpers/EventLoop.hpp"
+#include "../helpers/Memory.hpp"
+
+// --daemon: hyprshutdown started with the session, holding a live registry until --trigger connects.
+// Listens on a socket in the instance's runtime dir, next to Hyprland's.
+class CDaemon {
+  public:
+    CDaemon() = default;
+    ~CDaemon();
+
+    CDaemon(const CDaemon&) = delete;
+    CDaemon(CDaemon&)       = delete;
+    CDaemon(CDaemon&&)      = delete;
+
+    // fails if another daemon already listens for this instance
+    bool        listen();
+    // dispatches g_loop until triggered
+    void        waitForTrigger();
+    bool        triggered() const;
+
+    // for --trigger, true if a daemon took over
+    static bool trigger();
+
+    struct {
+        // State has begun the shutdown
+        Hyprutils::Signal::CSignalT<> triggered;
+    } m_events;
+
+  private:
+    // accepted, waiting on g_loop for their request
+    struct SClient {
+        Hyprutils::OS::CFileDescriptor fd;
+        SP<CEventLoopTimer>            timeout;
+    };
+
+    void                             onConnection();
+    void                             onClientReadable(int fd);
+    void                             dropClient(int fd);
+    void                             scheduleRefresh();
+
+    Hyprutils::OS::CFileDescriptor   m_socket;
+    std::string                      m_path;
+    std::unordered_map<int, SClient> m_clients;
+    SP<CEventLoopTimer>              m_refreshTimer;
+    bool                             m_triggered = false;
+};
+
+inline UP<CDaemon> g_daemon;
@@ -0,0 +1,200 @@
+#include "History.hpp"
+#include "../helpers/Logger.hpp"
+#include "../helpers/Memory.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include <hyprutils/os/FileDescriptor.hpp>
+
+using namespace State;
+
+// per class. Enough for a p99 that follows the app as it changes, and the log stays tiny.
+constexpr size_t SAMPLES_KEPT = 32;
+// fewer than this is too little to go on
+constexpr size_t MIN_SAMPLES = 3;
+// lines the log may have beyond what's kept before load() rewrites it
+constexpr size_t COMPACT_SLACK = 512;
+
+static std::string historyPath() {
+    const auto XDG = getenv("XDG_STATE_HOME");
+    if (XDG && XDG[0] != '\0')
+        return std::string{XDG} + "/hyprshutdown/exit-times";
+
+    const auto HOME = getenv("HOME");
+    if (!HOME || HOME[0] == '\0')
+        return "";
+
+    return std::string{HOME} + "/.local/state/hyprshutdown/exit-times";
+}
+
+// --all-instances workers share the log. Appends and compaction take this, so an append can't land in a file
+// that compaction is about to replace. Released when the fd is closed, not taken if the dir doesn't exist yet.
+static Hyprutils::OS::CFileDescriptor lockLog(const std::string& path) {
+    auto fd = Hyprutils::OS::CFileDescriptor{open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+
+    if (!fd.isValid())
+        return {};
+
+    while (flock(fd.get(), LOCK_EX) < 0) {
+        if (errno != EINTR)
+            return {};
+    }
+
+    return fd;
+}
+
+void CExitHistory::load() {
+    m_path = historyPath();
+
+    if (m_path.empty()) {
+        g_logger->log(LOG_DEBUG, "No state dir, not keeping exit times");
+        return;
+    }
+
+    // held until compacted
+    const auto LOCK = lockLog(m_path);
+
+    std::ifstream file(m_path);
+
+    if (!file.good()) {
+        g_logger->log(LOG_DEBUG, "No exit times at {} yet", m_path);
+        return;
+    }
+
+    size_t      lines = 0;
+    std::string line;
+
+    while (std::getline(file, line)) {
+        ++lines;
+
+        const auto TAB = line.rfind('\t');
+        if (TAB == std::string::npos || TAB == 0)
+            continue;
+
+        uint32_t   ms  = 0;
+        const auto END = line.data() + line.size();
+        const auto RES = std::from_chars(line.data() + TAB + 1, END, ms);
+
+        if (RES.ec != std::errc{} || RES.ptr != END)
+            continue;
+
+        add(std::string_view{line}.substr(0, TAB), ms);
+    }
+
+    size_t kept = 0;
+    for (const auto& [clazz, samples] : m_samples) {
+        kept += samples.size();
+    }
+
+    g_logger->log(LOG_DEBUG, "Loaded exit times of {} classes from {}", m_samples.size(), m_path);
+
+    if (lines > kept + COMPACT_SLACK)
+        compact();
+}
+
+void CExitHistory::save() {
+    if (m_path.empty() || m_unsaved.empty())
+        return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path{m_path}.parent_path(), ec);
+
+    const auto LOCK = lockLog(m_path);
+
+    std::ofstream file(m_path, std::ios::app);
+    file << m_unsaved;
+    file.flush();
+
+    if (!file.good()) {
+        g_logger->log(LOG_WARN, "Couldn't save exit times to {}", m_path);
+        return;
+    }
+
+    m_unsaved.clear();
+}
+
+void CExitHistory::record(std::string_view clazz, std::chrono::milliseconds took) {
+    // the log is line and tab separated
+    if (clazz.empty() || clazz.find_first_of("\t\n") != std::string_view::npos || took.count() < 0)
+        return;
+
+    const auto MS = sc<uint32_t>(std::min<int64_t>(took.count(), UINT32_MAX));
+
+    add(clazz, MS);
+    m_unsaved += std::format("{}\t{}\n", clazz, MS);
+}
+
+std::optional<std::chrono::milliseconds> CExitHistory::median(std::string_view clazz) const {
+    return percentile(clazz, 0.5F);
+}
+
+std::optional<std::chrono::milliseconds> CExitHistory::p99(std::string_view clazz) const {
+    return percentile(clazz, 0.99F);
+}
+
+void CExitHistory::add(std::string_view clazz, uint32_t ms) {
+    auto it = m_samples.find(clazz);
+    if (it == m_samples.end())
+        it = m_samples.emplace(std::string{clazz}, std::vector<uint32_t>{}).first;
+
+    auto& samples = it->second;
+
+    if (samples.size() >= SAMPLES_KEPT)
+        samples.erase(samples.begin());
+
+    samples.emplace_back(ms);
+}
+
+void CExitHistory::compact() {
+    const auto  TMP = m_path + ".tmp";
+
+    std::string data;
+    for (const auto& [clazz, samples] : m_samples) {
+        for (const auto& ms : samples) {
+            data += std::format("{}\t{}\n", clazz, ms);
+        }
+    }
+
+    std::ofstream file(TMP, std::ios::trunc);
+    file << data;
+    file.close();
+
+    std::error_code ec;
+    if (file.good())
+        std::filesystem::rename(TMP, m_path, ec);
+
+    if (!file.good() || ec) {
+        g_logger->log(LOG_WARN, "Couldn't compact exit times in {}", m_path);
+        std::filesystem::remove(TMP, ec);
+        return;
+    }
+
+    g_logger->log(LOG_DEBUG, "Compacted exit times in {}", m_path);
+}
+
+std::optional<std::chrono::milliseconds> CExitHistory::percentile(std::string_view clazz, float p) const {
+    const auto IT = m_samples.find(clazz);
+
+    if (IT == m_samples.end() || IT->second.size() < MIN_SAMPLES)
+        return std::nullopt;
+
+    // nearest rank, on a copy, the log order is the age order
+    auto       sorted = IT->second;
+    const auto RANK   = sc<size_t>(std::ceil(p * sorted.size())) - 1;
+
+    std::ranges::nth_element(sorted, sorted.begin() + RANK);
+
+    return std::chrono::milliseconds(sorted[RANK]);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../helpers/StringPool.hpp"
+
+namespace State {
+    // How long apps of a class took to exit after being asked, over the last runs.
+    // Kept in $XDG_STATE_HOME/hyprshutdown/exit-times, an append-only log of "class\tms" lines that load() compacts.
+    class CExitHistory {
+      public:
+        void                                     load();
+        // appends what was recorded since load()
+        void                                     save();
+
+        void                                     record(std::string_view clazz, std::chrono::milliseconds took);
+
+        // nullopt until the class has a few samples
+        std::optional<std::chrono::milliseconds> median(std::string_view clazz) const;
+        std::optional<std::chrono::milliseconds> p99(std::string_view clazz) const;
+
+      private:
+        void                                                                                 add(std::string_view clazz, uint32_t ms);
+        void                                                                                 compact();
+        std::optional<std::chrono::milliseconds>                                             percentile(std::string_view clazz, float p) const;
+
+        std::string                                                                          m_path;
+        // per class, oldest first
+        std::unordered_map<std::string, std::vector<uint32_t>, SStringHash, std::equal_to<>> m_samples;
+        std::string                                                                          m_unsaved;
+    };
+};
@@ -14,12 +14,22 @@
 #include <algorithm>
 #include <charconv>
 #include <csignal>
+#include <ranges>
+#include <cstring>
 
 #include <hyprutils/memory/Casts.hpp>
-#include <hyprutils/utils/ScopeGuard.hpp>
+
+#include "../helpers/Memory.hpp"
+#include "../helpers/Trace.hpp"
 
 using namespace Hyprutils::Memory;
 
+constexpr std::string_view BATCH_DELIMITER = "\n\n\n";
+// smallest read, also the initial buffer size
+constexpr size_t           RECEIVE_CHUNK = 8192;
+// between connects while the compositor's backlog is full
+constexpr auto             CONNECT_RETRY = std::chrono::milliseconds(5);
+
 static int getUID() {
     const auto UID   = getuid();
     const auto PWUID = getpwuid(UID);
@@ -45,68 +55,394 @@ static std::optional<uint64_t> toUInt64(const std::string_view str) {
     return value;
 }
 
-std::expected<std::string, std::string> HyprlandIPC::getFromSocket(const std::string& cmd) {
-    static const auto HIS = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+HyprlandIPC::CReceiveBuffer::eReadResult HyprlandIPC::CReceiveBuffer::readFrom(int fd) {
+    while (true) {
+        // always room for a whole chunk and the terminator
+        if (m_data.size() - m_size < RECEIVE_CHUNK + 1)
+            m_data.resize(std::max(m_data.size() * 2, m_size + RECEIVE_CHUNK + 1));
 
-    if (!HIS || HIS[0] == '\0')
-        return std::unexpected("HYPRLAND_INSTANCE_SIGNATURE empty: are we under hyprland?");
+        const auto LEN = read(fd, m_data.data() + m_size, m_data.size() - m_size - 1);
+
+        if (LEN == 0) {
+            m_data[m_size] = '\0';
+            return READ_EOF;
+        }
+
+        if (LEN < 0) {
+            if (errno == EINTR)
+                continue;
+
+            m_data[m_size] = '\0';
+            return errno == EAGAIN || errno == EWOULDBLOCK ? READ_AGAIN : READ_ERROR;
+        }
+
+        m_size += LEN;
+    }
+}
+
+std::string_view HyprlandIPC::CReceiveBuffer::view() const {
+    return {m_data.data(), m_size};
+}
+
+void HyprlandIPC::CReceiveBuffer::consume(size_t len) {
+    len = std::min(len, m_size);
+
+    std::memmove(m_data.data(), m_data.data() + len, m_size - len);
+    m_size -= len;
+
+    if (!m_data.empty())
+        m_data[m_size] = '\0';
+}
+
+void HyprlandIPC::CReceiveBuffer::clear() {
+    consume(m_size);
+}
+
+static std::expected<std::vector<std::string_view>, std::string> splitBatchReply(std::string_view reply, size_t count) {
+    std::vector<std::string_view> replies;
+    replies.reserve(count);
 
-    const auto SERVERSOCKET = socket(AF_UNIX, SOCK_STREAM, 0);
+    // newer Hyprland separates batch replies with a delimiter
+    for (const auto& r : std::views::split(reply, BATCH_DELIMITER)) {
+        replies.emplace_back(std::string_view{r});
+    }
+
+    if (replies.size() == count)
+        return replies;
+
+    // older ones just concatenate them, which we can only attribute if everything went ok
+    bool allOk = reply.size() == count * 2;
+    for (size_t i = 0; allOk && i < count; ++i) {
+        allOk = reply.substr(i * 2, 2) == "ok";
+    }
+
+    if (allOk)
+        return std::vector<std::string_view>(count, "ok");
+
+    return std::unexpected(std::format("couldn't attribute batch reply: {}", reply));
+}
+
+static std::vector<UP<HyprlandIPC::CReceiveBuffer>>& bufferPool() {
+    static std::vector<UP<HyprlandIPC::CReceiveBuffer>> pool;
+    return pool;
+}
+
+// requests keep themselves alive until they finish. Constructed after g_loop and the pool, so destroyed before them.
+static std::vector<SP<HyprlandIPC::CRequest>>& inflightRequests() {
+    bufferPool();
 
-    auto       t = timeval{.tv_sec = 5, .tv_usec = 0};
-    setsockopt(SERVERSOCKET, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(struct timeval));
+    static std::vector<SP<HyprlandIPC::CRequest>> requests;
+    return requests;
+}
+
+// replies are read into pooled buffers, so polling doesn't allocate for every reply
+static UP<HyprlandIPC::CReceiveBuffer> acquireBuffer() {
+    auto& pool = bufferPool();
+
+    if (pool.empty())
+        return makeUnique<HyprlandIPC::CReceiveBuffer>();
+
+    auto buf = std::move(pool.back());
+    pool.pop_back();
+    return buf;
+}
 
-    if (SERVERSOCKET < 0)
-        return std::unexpected("couldn't open a socket (1)");
+static void releaseBuffer(UP<HyprlandIPC::CReceiveBuffer>&& buf) {
+    if (!buf)
+        return;
 
-    auto socketGuard = Hyprutils::Utils::CScopeGuard([&] { close(SERVERSOCKET); });
+    buf->clear();
+    bufferPool().emplace_back(std::move(buf));
+}
+
+HyprlandIPC::CRequest::CRequest(std::string&& request, ReplyCallback&& cb) : m_request(std::move(request)), m_reply(acquireBuffer()), m_cb(std::move(cb)) {
+    ;
+}
+
+HyprlandIPC::CRequest::~CRequest() {
+    cleanup();
+}
+
+void HyprlandIPC::CRequest::start(std::chrono::milliseconds timeout) {
+    if (g_trace->enabled())
+        m_started = CTrace::Clock::now();
+
+    m_timer = g_loop->addTimer(timeout, [this] { finish(std::unexpected(m_error.empty() ? "Hyprland IPC didn't respond in time" : m_error)); });
+
+    tryConnect();
+}
+
+void HyprlandIPC::CRequest::tryConnect() {
+    const auto INSTANCE = currentInstance();
+
+    if (!INSTANCE) {
+        fail(std::string{INSTANCE.error()});
+        return;
+    }
+
+    const auto* SOCKETPATH = &(*INSTANCE)->requestSocketPath;
+
+    m_fd = Hyprutils::OS::CFileDescriptor{socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+
+    if (!m_fd.isValid()) {
+        fail("couldn't open a socket (1)");
+        return;
+    }
 
     sockaddr_un serverAddress = {0};
     serverAddress.sun_family  = AF_UNIX;
 
-    std::string socketPath = getRuntimeDir() + "/" + HIS + "/.socket.sock";
+    strncpy(serverAddress.sun_path, SOCKETPATH->c_str(), sizeof(serverAddress.sun_path) - 1);
+
+    if (connect(m_fd.get(), rc<sockaddr*>(&serverAddress), SUN_LEN(&serverAddress)) < 0 && errno != EINPROGRESS) {
+        // the compositor's backlog is full, a blocking connect would wait for it too. Until the deadline.
+        if (errno == EAGAIN) {
+            m_fd.reset();
+            m_error      = "Hyprland IPC is too busy to accept a connection";
+            m_retryTimer = g_loop->addTimer(CONNECT_RETRY, [this] { tryConnect(); });
+            return;
+        }
+
+        fail(std::format("couldn't connect to the hyprland socket at {}", *SOCKETPATH));
+        return;
+    }
 
-    strncpy(serverAddress.sun_path, socketPath.c_str(), sizeof(serverAddress.sun_path) - 1);
+    m_error.clear();
 
-    if (connect(SERVERSOCKET, rc<sockaddr*>(&serverAddress), SUN_LEN(&serverAddress)) < 0)
-        return std::unexpected(std::format("couldn't connect to the hyprland socket at {}", socketPath));
+    // write right away, so the compositor gets the request even before the loop runs
+    if (!flush()) {
+        fail("couldn't write (4)");
+        return;
+    }
 
-    auto sizeWritten = write(SERVERSOCKET, cmd.c_str(), cmd.length());
+    g_loop->addFd(m_fd.get(), [this] { onSocket(); }, m_written < m_request.size() ? EPOLLOUT : EPOLLIN);
+}
 
-    if (sizeWritten < 0)
-        return std::unexpected("couldn't write (4)");
+bool HyprlandIPC::CRequest::flush() {
+    while (m_written < m_request.size()) {
+        const auto LEN = write(m_fd.get(), m_request.c_str() + m_written, m_request.size() - m_written);
 
-    std::string reply        = "";
-    char        buffer[8192] = {0};
+        if (LEN < 0) {
+            if (errno == EINTR)
+                continue;
 
-    sizeWritten = read(SERVERSOCKET, buffer, 8192);
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN /* connect still in progress */;
+        }
 
-    if (sizeWritten < 0) {
-        if (errno == EWOULDBLOCK)
-            return std::unexpected("Hyprland IPC didn't respond in time");
-        return std::unexpected("couldn't read (5)");
+        m_written += LEN;
     }
 
-    reply += std::string(buffer, sizeWritten);
+    // the compositor reads until EOF or a short pause, this saves it waiting out the pause
+    shutdown(m_fd.get(), SHUT_WR);
+
+    return true;
+}
 
-    while (sizeWritten == 8192) {
-        sizeWritten = read(SERVERSOCKET, buffer, 8192);
-        if (sizeWritten < 0) {
-            return std::unexpected("couldn't read (5)");
+void HyprlandIPC::CRequest::onSocket() {
+    if (m_written < m_request.size()) {
+        if (!flush()) {
+            finish(std::unexpected("couldn't write (4)"));
+            return;
         }
-        reply += std::string(buffer, sizeWritten);
+
+        if (m_written == m_request.size())
+            g_loop->modifyFd(m_fd.get(), EPOLLIN);
+
+        return;
     }
 
-    return reply;
+    switch (m_reply->readFrom(m_fd.get())) {
+        // hyprland closes the connection once the reply is written
+        case CReceiveBuffer::READ_EOF: finish(m_reply->view()); break;
+        case CReceiveBuffer::READ_AGAIN: break;
+        default: finish(std::unexpected("couldn't read (5)")); break;
+    }
 }
 
-static std::optional<HyprlandIPC::SInstanceData> parseInstance(const std::filesystem::directory_entry& entry) {
-    if (!entry.is_directory())
-        return std::nullopt;
+void HyprlandIPC::CRequest::fail(std::string&& err) {
+    // don't call back from inside request(), let the loop do it
+    m_error = std::move(err);
+    cleanup();
+    m_timer = g_loop->addTimer(std::chrono::milliseconds(0), [this] { finish(std::unexpected(m_error)); });
+}
+
+void HyprlandIPC::CRequest::finish(std::expected<std::string_view, std::string>&& result) {
+    if (m_done)
+        return;
+
+    m_done = true;
+    cleanup();
+
+    if (g_trace->enabled()) {
+        // batches can be long, the start says enough
+        const auto NAME = std::string_view{m_request}.substr(0, 64);
+        if (result)
+            g_trace->complete(NAME, "ipc", m_started, CTrace::Clock::now(), {{"bytes", sc<int64_t>(result->size())}});
+        else
+            g_trace->complete(NAME, "ipc", m_started, CTrace::Clock::now(), {{"error", std::string_view{result.error()}}});
+    }
+
+    auto       cb = std::move(m_cb);
+
+    auto&      inflight = inflightRequests();
+    const auto IT       = std::ranges::find_if(inflight, [this](const auto& r) { return r.get() == this; });
+    // the callback can drop the last handle to us, so keep ourselves alive until we return
+    auto self = *IT;
+    inflight.erase(IT);
+
+    if (cb)
+        cb(std::move(result));
+
+    releaseBuffer(std::move(m_reply));
+}
+
+void HyprlandIPC::CRequest::cleanup() {
+    if (m_timer) {
+        m_timer->cancel();
+        m_timer.reset();
+    }
+
+    if (m_retryTimer) {
+        m_retryTimer->cancel();
+        m_retryTimer.reset();
+    }
+
+    if (m_fd.isValid()) {
+        g_loop->removeFd(m_fd.get());
+        m_fd.reset();
+    }
+}
+
+void HyprlandIPC::CRequest::cancel() {
+    if (m_done)
+        return;
+
+    m_done = true;
+    m_cb   = nullptr;
+    cleanup();
+    releaseBuffer(std::move(m_reply));
+
+    std::erase_if(inflightRequests(), [this](const auto& r) { return r.get() == this; });
+}
+
+bool HyprlandIPC::CRequest::done() const {
+    return m_done;
+}
+
+SP<HyprlandIPC::CRequest> HyprlandIPC::request(const std::string& cmd, ReplyCallback&& cb, std::chrono::milliseconds timeout) {
+    auto req = makeShared<CRequest>(std::string{cmd}, std::move(cb));
+    inflightRequests().emplace_back(req);
+    req->start(timeout);
+    return req;
+}
+
+SP<HyprlandIPC::CRequest> HyprlandIPC::requestBatch(const std::vector<std::string>& cmds, BatchReplyCallback&& cb, std::chrono::milliseconds timeout) {
+    std::string request = "[[BATCH]]";
+    for (const auto& c : cmds) {
+        request += c;
+        request += ';';
+    }
+    request.pop_back();
+
+    return HyprlandIPC::request(
+        request,
+        [count = cmds.size(), cb = std::move(cb)](std::expected<std::string_view, std::string>&& ret) {
+            if (!ret)
+                cb(std::unexpected(ret.error()));
+            else
+                cb(splitBatchReply(*ret, count));
+        },
+        timeout);
+}
+
+bool HyprlandIPC::CEventSocket::connect() {
+    const auto INSTANCE = currentInstance();
+
+    if (!INSTANCE)
+        return false;
+
+    const auto* SOCKETPATH = &(*INSTANCE)->eventSocketPath;
+
+    auto fd = Hyprutils::OS::CFileDescriptor{socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+
+    if (!fd.isValid())
+        return false;
 
-    const auto    lockPath = entry.path() / "hyprland.lock";
-    std::ifstream ifs(lockPath);
+    sockaddr_un serverAddress = {0};
+    serverAddress.sun_family  = AF_UNIX;
+
+    strncpy(serverAddress.sun_path, SOCKETPATH->c_str(), sizeof(serverAddress.sun_path) - 1);
+
+    if (::connect(fd.get(), rc<sockaddr*>(&serverAddress), SUN_LEN(&serverAddress)) < 0)
+        return false;
+
+    m_fd = std::move(fd);
+    m_buffer.clear();
+
+    return true;
+}
+
+int HyprlandIPC::CEventSocket::fd() const {
+    return m_fd.isValid() ? m_fd.get() : -1;
+}
+
+bool HyprlandIPC::CEventSocket::dispatch(const std::function<void(std::string_view, std::string_view)>& onEvent) {
+    if (!m_fd.isValid())
+        return false;
+
+    // anything but EAGAIN means the compositor closed the socket
+    if (m_buffer.readFrom(m_fd.get()) != CReceiveBuffer::READ_AGAIN)
+        return false;
+
+    // events are "name>>data\n", the last one might be incomplete
+    const auto DATA  = m_buffer.view();
+    size_t     begin = 0;
+    for (size_t end = DATA.find('\n'); end != std::string_view::npos; begin = end + 1, end = DATA.find('\n', begin)) {
+        const auto LINE = DATA.substr(begin, end - begin);
+        const auto SEP  = LINE.find(">>");
+
+        if (SEP == std::string_view::npos)
+            continue;
+
+        onEvent(LINE.substr(0, SEP), LINE.substr(SEP + 2));
+    }
+
+    m_buffer.consume(begin);
+
+    return true;
+}
+
+void HyprlandIPC::CEventSocket::close() {
+    m_fd.reset();
+    m_buffer.clear();
+}
+
+// pid and wayland socket, the only lines of a lock file
+static bool readLockFile(const std::filesystem::path& path, HyprlandIPC::SInstanceData& data) {
+    std::ifstream ifs(path);
     if (!ifs.is_open())
+        return false;
+
+    std::string line;
+    if (!std::getline(ifs, line))
+        return false;
+
+    auto pid = toUInt64(std::string_view{line});
+    if (!pid)
+        return false;
+    data.pid = *pid;
+
+    if (!std::getline(ifs, data.wlSocket))
+        return false;
+
+    if (std::getline(ifs, line) && !line.empty())
+        return false; // more lines than expected
+
+    return true;
+}
+
+static std::optional<HyprlandIPC::SInstanceData> parseInstance(const std::filesystem::directory_entry& entry) {
+    if (!entry.is_directory())
         return std::nullopt;
 
     HyprlandIPC::SInstanceData data;
@@ -122,21 +458,9 @@ static std::optional<HyprlandIPC::SInstanceData> parseInstance(const std::filesy
         return std::nullopt;
     data.time = *time;
 
-    std::string line;
-    if (!std::getline(ifs, line))
+    if (!readLockFile(entry.path() / "hyprland.lock", data))
         return std::nullopt;
 
-    auto pid = toUInt64(std::string_view{line});
-    if (!pid)
-        return std::nullopt;
-    data.pid = *pid;
-
-    if (!std::getline(ifs, data.wlSocket))
-        return std::nullopt;
-
-    if (std::getline(ifs, line) && !line.empty())
-        return std::nullopt; // more lines than expected
-
     return data;
 }
 
@@ -163,3 +487,31 @@ std::vector<HyprlandIPC::SInstanceData> HyprlandIPC::instances() {
 
     return result;
 }
+
+std::expected<const HyprlandIPC::SCurrentInstance*, std::string> HyprlandIPC::currentInstance() {
+    static const auto INSTANCE = []() -> std::optional<SCurrentInstance> {
+        const auto HIS = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+
+        if (!HIS || HIS[0] == '\0')
+            return std::nullopt;
+
+        const auto       DIR = getRuntimeDir() + "/" + HIS;
+
+        SCurrentInstance instance;
+        instance.signature         = HIS;
+        instance.dir               = DIR;
+        instance.requestSocketPath = DIR + "/.socket.sock";
+        instance.eventSocketPath   = DIR + "/.socket2.sock";
+
+        // the lock of a compositor that's gone is stale
+        if (SInstanceData data; readLockFile(DIR + "/hyprland.lock", data) && (kill(data.pid, 0) == 0 || errno != ESRCH))
+            instance.pid = data.pid;
+
+        return instance;
+    }();
+
+    if (!INSTANCE)
+        return std::unexpected("HYPRLAND_INSTANCE_SIGNATURE empty: are we under hyprland?");
+
+    return &*INSTANCE;
+}
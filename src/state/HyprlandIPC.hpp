@@ -4,6 +4,13 @@
 #include <expected>
 #include <cstdint>
 #include <vector>
+#include <functional>
+#include <string_view>
+#include <chrono>
+
+#include <hyprutils/os/FileDescriptor.hpp>
+
+#include "../helpers/EventLoop.hpp"
 
 namespace HyprlandIPC {
     struct SInstanceData {
@@ -13,6 +20,114 @@ namespace HyprlandIPC {
         std::string wlSocket;
     };
 
-    std::expected<std::string, std::string> getFromSocket(const std::string& cmd);
-    std::vector<HyprlandIPC::SInstanceData> instances();
+    // The instance we run under, resolved once from $HYPRLAND_INSTANCE_SIGNATURE and its lock file alone
+    struct SCurrentInstance {
+        std::string signature;
+        // where its sockets live
+        std::string dir;
+        std::string requestSocketPath, eventSocketPath;
+        // -1 if the lock file couldn't be read or is stale
+        int64_t     pid = -1;
+    };
+
+    // Receive buffer that is kept between replies. Grows geometrically and never shrinks,
+    // so once it fits the biggest reply, reading doesn't allocate anymore.
+    class CReceiveBuffer {
+      public:
+        enum eReadResult : uint8_t {
+            READ_EOF = 0,
+            READ_AGAIN,
+            READ_ERROR,
+        };
+
+        // reads everything available until EOF, or until fd would block
+        eReadResult      readFrom(int fd);
+
+        // valid until the next read, consume or clear. Followed by a '\0' for parsers that want one.
+        std::string_view view() const;
+        void             consume(size_t len);
+        void             clear();
+
+      private:
+        std::vector<char> m_data;
+        size_t            m_size = 0;
+    };
+
+    // Subscription to the compositor's event socket (.socket2.sock)
+    class CEventSocket {
+      public:
+        CEventSocket()  = default;
+        ~CEventSocket() = default;
+
+        CEventSocket(const CEventSocket&) = delete;
+        CEventSocket(CEventSocket&)       = delete;
+        CEventSocket(CEventSocket&&)      = delete;
+
+        bool connect();
+        void close();
+        int  fd() const;
+
+        // reads everything available and calls onEvent(name, data) for every complete event.
+        // returns false if the socket was closed or errored.
+        bool dispatch(const std::function<void(std::string_view, std::string_view)>& onEvent);
+
+      private:
+        Hyprutils::OS::CFileDescriptor m_fd;
+        CReceiveBuffer                 m_buffer;
+    };
+
+    // replies are only valid during the callback
+    using ReplyCallback      = std::function<void(std::expected<std::string_view, std::string>&&)>;
+    using BatchReplyCallback = std::function<void(std::expected<std::vector<std::string_view>, std::string>&&)>;
+
+    constexpr auto DEFAULT_TIMEOUT = std::chrono::seconds(5);
+
+    // A request in flight on g_loop. The callback runs exactly once, unless cancelled.
+    class CRequest {
+      public:
+        CRequest(std::string&& request, ReplyCallback&& cb);
+        ~CRequest();
+
+        CRequest(const CRequest&) = delete;
+        CRequest(CRequest&)       = delete;
+        CRequest(CRequest&&)      = delete;
+
+        void cancel();
+        bool done() const;
+
+      private:
+        void                           start(std::chrono::milliseconds timeout);
+        void                           tryConnect();
+        bool                           flush();
+        void                           onSocket();
+        void                           fail(std::string&& err);
+        void                           finish(std::expected<std::string_view, std::string>&& result);
+        void                           cleanup();
+
+        std::string                    m_request, m_error;
+        UP<CReceiveBuffer>             m_reply;
+        size_t                         m_written = 0;
+        ReplyCallback                  m_cb;
+        bool                           m_done = false;
+
+        Hyprutils::OS::CFileDescriptor m_fd;
+        SP<CEventLoopTimer>            m_timer;
+        // for connecting again while the compositor's backlog is full
+        SP<CEventLoopTimer>            m_retryTimer;
+
+        // for tracing, only set when enabled
+        std::chrono::steady_clock::time_point m_started;
+
+        friend SP<CRequest> request(const std::string& cmd, ReplyCallback&& cb, std::chrono::milliseconds timeout);
+    };
+
+    // non-blocking, the callback is called from g_loop. Dropping the returned handle doesn't cancel.
+    SP<CRequest>                                  request(const std::string& cmd, ReplyCallback&& cb, std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+    // sends all commands in one [[BATCH]] request, the callback gets one reply per command
+    SP<CRequest> requestBatch(const std::vector<std::string>& cmds, BatchReplyCallback&& cb, std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+
+    // every instance in the runtime dir, oldest first. Reads all their lock files.
+    std::vector<HyprlandIPC::SInstanceData>       instances();
+    // cached after the first call, fails only outside of Hyprland
+    std::expected<const SCurrentInstance*, std::string> currentInstance();
 };
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glaze/glaze.hpp>
+
+// The parts of Hyprland's json replies we use. Everything else is skipped while parsing.
+namespace HyprlandIPC {
+    struct SClient {
+        std::string address;
+        std::string title;
+        std::string clazz;
+        int64_t     pid      = -1;
+        bool        xwayland = false;
+    };
+
+    struct SLayer {
+        std::string address;
+        std::string nameSpace;
+        int64_t     pid = -1;
+    };
+
+    // j/layers is monitor -> levels -> level -> layers
+    struct SMonitorLayers {
+        std::map<std::string, std::vector<SLayer>> levels;
+    };
+
+    struct SStatus {
+        std::string configProvider;
+    };
+
+    constexpr glz::opts JSON_OPTS = {.error_on_unknown_keys = false};
+};
+
+template <>
+struct glz::meta<HyprlandIPC::SClient> {
+    using T                     = HyprlandIPC::SClient;
+    static constexpr auto value = glz::object("address", &T::address, "title", &T::title, "class", &T::clazz, "pid", &T::pid, "xwayland", &T::xwayland);
+};
+
+template <>
+struct glz::meta<HyprlandIPC::SLayer> {
+    using T                     = HyprlandIPC::SLayer;
+    static constexpr auto value = glz::object("address", &T::address, "namespace", &T::nameSpace, "pid", &T::pid);
+};
+
+template <>
+struct glz::meta<HyprlandIPC::SMonitorLayers> {
+    using T                     = HyprlandIPC::SMonitorLayers;
+    static constexpr auto value = glz::object("levels", &T::levels);
+};
+
+template <>
+struct glz::meta<HyprlandIPC::SStatus> {
+    using T                     = HyprlandIPC::SStatus;
+    static constexpr auto value = glz::object("configProvider", &T::configProvider);
+};
@@ -0,0 +1,228 @@
+#include "Shutdown.hpp"
+#include "AppState.hpp"
+#include "../helpers/Logger.hpp"
+#include "../helpers/Trace.hpp"
+#include "../helpers/Progress.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <print>
+
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <hyprutils/os/Process.hpp>
+
+using namespace Hyprutils::OS;
+
+constexpr auto   TICK_INTERVAL = std::chrono::milliseconds(150);
+// apps named per progress line, the rest is counted
+constexpr size_t PROGRESS_NAMES = 5;
+
+static std::string_view outcomeName(CShutdown::eOutcome outcome) {
+    switch (outcome) {
+        case CShutdown::OUTCOME_CLOSED: return "all apps closed";
+        case CShutdown::OUTCOME_FORCE_KILLED: return "force killed";
+        case CShutdown::OUTCOME_CANCELLED: return "cancelled";
+        case CShutdown::OUTCOME_TIMED_OUT: return "timed out";
+    }
+
+    return "unknown";
+}
+
+void CShutdown::start() {
+    if (m_started)
+        return;
+
+    m_started = true;
+
+    watchSignals();
+
+    if (m_timeout)
+        m_timeoutTimer = g_loop->addTimer(*m_timeout, [this] { timedOut(); });
+
+    m_tickTimer = g_loop->addTimer(TICK_INTERVAL, [this] { tick(); });
+}
+
+void CShutdown::tick() {
+    const auto STATE = State::state();
+
+    if (STATE->apps().empty()) {
+        finish(OUTCOME_CLOSED);
+        return;
+    }
+
+    STATE->updateState();
+
+    m_tickTimer = g_loop->addTimer(TICK_INTERVAL, [this] { tick(); });
+}
+
+void CShutdown::forceQuit() {
+    if (finished())
+        return;
+
+    State::state()->killAllApps();
+    finish(OUTCOME_FORCE_KILLED);
+}
+
+void CShutdown::cancel() {
+    if (finished())
+        return;
+
+    finish(OUTCOME_CANCELLED);
+}
+
+void CShutdown::timedOut() {
+    if (finished())
+        return;
+
+    g_logger->log(LOG_WARN, "Apps still open after {}ms, force quitting {} of them", m_timeout->count(), State::state()->apps().size());
+
+    State::state()->killAllApps();
+    finish(OUTCOME_TIMED_OUT);
+}
+
+void CShutdown::finish(eOutcome outcome) {
+    m_outcome = outcome;
+
+    if (m_tickTimer)
+        m_tickTimer->cancel();
+    if (m_timeoutTimer)
+        m_timeoutTimer->cancel();
+
+    // the post command shouldn't inherit our signal mask
+    unwatchSignals();
+
+    State::state()->saveHistory();
+
+    g_logger->log(LOG_DEBUG, "Shutdown finished after {:.2f}s: {}", State::state()->secondsPassed(), outcomeName(outcome));
+    g_trace->instant("shutdown finished", "escalation", {{"outcome", outcomeName(outcome)}});
+
+    if (outcome == OUTCOME_CANCELLED)
+        g_progress->event("cancelled");
+    g_progress->event("finished", {{"outcome", outcomeName(outcome)}, {"status", sc<int64_t>(outcome)}});
+
+    m_events.finished.emit();
+}
+
+void CShutdown::exitCompositor() {
+    if (m_outcome == OUTCOME_CANCELLED || m_noExit || State::state()->m_dryRun) {
+        m_done = true;
+        g_loop->leaveLoop();
+        return;
+    }
+
+    //NOLINTNEXTLINE
+    std::string cmd = State::state()->m_useLua ? "/dispatch hl.dsp.exit()" : "/dispatch exit";
+    g_trace->instant("exit hyprland", "escalation");
+    g_progress->event("compositor_exit");
+    m_exitRequest = HyprlandIPC::request(cmd, [this](std::expected<std::string_view, std::string>&& ret) {
+        if (!ret)
+            g_logger->log(LOG_ERR, "Failed to exit Hyprland: {}", ret.error());
+
+        if (m_postExitCmd) {
+            g_progress->event("post_cmd", {{"cmd", std::string_view{*m_postExitCmd}}});
+            CProcess proc("/bin/sh", {"-c", m_postExitCmd.value()});
+            proc.runAsync();
+        }
+
+        m_done = true;
+        g_loop->leaveLoop();
+    });
+}
+
+void CShutdown::wait() {
+    while (!m_done) {
+        g_loop->enterLoop();
+    }
+}
+
+int CShutdown::runHeadless() {
+    auto finishedListener = m_events.finished.listen([this] {
+        std::println(stderr, "{}[{:.1f}s] {}", progressPrefix(), State::state()->secondsPassed(), outcomeName(outcome()));
+        exitCompositor();
+    });
+    auto changedListener = State::state()->m_events.changed.listen([this] { reportProgress(); });
+
+    reportProgress();
+
+    start();
+    wait();
+
+    return outcome();
+}
+
+bool CShutdown::finished() const {
+    return m_outcome.has_value();
+}
+
+CShutdown::eOutcome CShutdown::outcome() const {
+    return m_outcome.value_or(OUTCOME_CANCELLED);
+}
+
+void CShutdown::watchSignals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    sigprocmask(SIG_BLOCK, &mask, &m_oldSignalMask);
+
+    m_signalFd = CFileDescriptor{signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)};
+
+    if (!m_signalFd.isValid()) {
+        g_logger->log(LOG_WARN, "CShutdown: signalfd failed, SIGINT and SIGTERM won't cancel: {}", strerror(errno));
+        sigprocmask(SIG_SETMASK, &m_oldSignalMask, nullptr);
+        return;
+    }
+
+    g_loop->addFd(m_signalFd.get(), [this] {
+        signalfd_siginfo info = {};
+        while (read(m_signalFd.get(), &info, sizeof(info)) == sizeof(info)) {
+            g_logger->log(LOG_DEBUG, "Got signal {}, cancelling", info.ssi_signo);
+        }
+
+        cancel();
+    });
+}
+
+void CShutdown::unwatchSignals() {
+    if (!m_signalFd.isValid())
+        return;
+
+    g_loop->removeFd(m_signalFd.get());
+    m_signalFd.reset();
+
+    sigprocmask(SIG_SETMASK, &m_oldSignalMask, nullptr);
+}
+
+void CShutdown::reportProgress() {
+    const auto& APPS = State::state()->apps();
+
+    if (APPS.size() == m_lastReported || APPS.empty())
+        return;
+
+    m_lastReported = APPS.size();
+
+    std::string names;
+    for (size_t i = 0; i < std::min(APPS.size(), PROGRESS_NAMES); ++i) {
+        if (!names.empty())
+            names += ", ";
+
+        if (APPS[i]->m_class.empty())
+            names += std::format("pid {}", APPS[i]->m_pid);
+        else
+            names += APPS[i]->m_class;
+    }
+
+    if (APPS.size() > PROGRESS_NAMES)
+        names += std::format(" and {} more", APPS.size() - PROGRESS_NAMES);
+
+    std::println(stderr, "{}[{:.1f}s] waiting for {} app{}: {}", progressPrefix(), State::state()->secondsPassed(), APPS.size(), APPS.size() == 1 ? "" : "s", names);
+}
+
+std::string CShutdown::progressPrefix() const {
+    return m_instanceName.empty() ? "" : std::format("{}: ", m_instanceName);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include <csignal>
+
+#include <hyprutils/os/FileDescriptor.hpp>
+#include <hyprutils/signal/Signal.hpp>
+
+#include "../helpers/EventLoop.hpp"
+#include "../helpers/Memory.hpp"
+#include "HyprlandIPC.hpp"
+
+// Drives the shutdown once State is up: ticks it, gives up on the timeout and exits Hyprland once everything is gone.
+// Lives on g_loop alone, the UI is only a view on top of it. With --no-ui, runHeadless() is all there is.
+class CShutdown {
+  public:
+    CShutdown()  = default;
+    ~CShutdown() = default;
+
+    CShutdown(const CShutdown&) = delete;
+    CShutdown(CShutdown&)       = delete;
+    CShutdown(CShutdown&&)      = delete;
+
+    // also the exit status
+    enum eOutcome : uint8_t {
+        OUTCOME_CLOSED       = 0,
+        OUTCOME_FORCE_KILLED = 2,
+        OUTCOME_CANCELLED    = 3,
+        OUTCOME_TIMED_OUT    = 4,
+    };
+
+    // starts ticking, the timeout and cancelling on SIGINT / SIGTERM. Only does so once.
+    void                                     start();
+    void                                     forceQuit();
+    void                                     cancel();
+    // exits Hyprland unless cancelled or told not to, then runs the post command
+    void                                     exitCompositor();
+    // dispatches g_loop until exitCompositor() is done
+    void                                     wait();
+    // the whole shutdown without a UI, progress goes to stderr. Returns the exit status.
+    int                                      runHeadless();
+
+    bool                                     finished() const;
+    eOutcome                                 outcome() const;
+
+    bool                                     m_noExit = false;
+    std::optional<std::string>               m_postExitCmd;
+    std::optional<std::chrono::milliseconds> m_timeout;
+    // set with --all-instances, progress lines say which instance they're about
+    std::string                              m_instanceName;
+
+    struct {
+        // the outcome is known, anything on screen should go
+        Hyprutils::Signal::CSignalT<> finished;
+    } m_events;
+
+  private:
+    void                           tick();
+    void                           timedOut();
+    void                           finish(eOutcome outcome);
+    void                           watchSignals();
+    void                           unwatchSignals();
+    void                           reportProgress();
+    std::string                    progressPrefix() const;
+
+    std::optional<eOutcome>        m_outcome;
+    bool                           m_started = false;
+    bool                           m_done    = false;
+
+    SP<CEventLoopTimer>            m_tickTimer, m_timeoutTimer;
+    SP<HyprlandIPC::CRequest>      m_exitRequest;
+
+    Hyprutils::OS::CFileDescriptor m_signalFd;
+    sigset_t                       m_oldSignalMask = {};
+
+    size_t                         m_lastReported = SIZE_MAX;
+};
+
+inline UP<CShutdown> g_shutdown = makeUnique<CShutdown>();
@@ -1,22 +1,25 @@
 #include "UI.hpp"
 #include "../helpers/Logger.hpp"
 #include "../state/AppState.hpp"
-#include "../state/HyprlandIPC.hpp"
+#include "../state/Shutdown.hpp"
+#include "../state/Daemon.hpp"
+#include "../helpers/EventLoop.hpp"
+#include "../helpers/Trace.hpp"
 
 #include <algorithm>
+#include <cmath>
+#include <optional>
 
 #include <hyprtoolkit/core/Output.hpp>
 #include <hyprtoolkit/types/SizeType.hpp>
 #include <hyprutils/memory/SharedPtr.hpp>
-#include <hyprutils/os/Process.hpp>
-
-using namespace Hyprutils::OS;
 
 namespace {
     using ButtonPtr                        = Hyprutils::Memory::CSharedPointer<Hyprtoolkit::CButtonElement>;
     constexpr float kButtonBaseHeight      = 25.F;
     constexpr float kButtonFontScale       = 0.40F;
     constexpr float kButtonCharWidthFactor = 0.6F;
+    constexpr auto  kEtaInterval           = std::chrono::seconds(1);
 
     float           buttonWidthForLabel(std::string_view label, float padding, float fontSize) {
         const float textWidth = static_cast<float>(label.size()) * (fontSize * kButtonCharWidthFactor);
@@ -44,12 +47,28 @@ namespace {
 
         return btn;
     }
+
+    std::string subText(std::optional<float> secondsLeft) {
+        constexpr std::string_view HINT = "<i>You can force quit Hyprland, but that risks losing unsaved progress.</i>";
+
+        if (!secondsLeft)
+            return std::format("Waiting for your apps to exit.\n{}", HINT);
+
+        return std::format("Waiting for your apps to exit, this usually takes about {}s more.\n{}", sc<int>(std::ceil(*secondsLeft)), HINT);
+    }
+
+    std::string classText(std::string_view clazz, bool stuck) {
+        if (!stuck)
+            return std::string{clazz};
+
+        return std::format("{} <i>(taking longer than usual)</i>", clazz);
+    }
 }
 
 CUI::CUI()  = default;
 CUI::~CUI() = default;
 
-CMonitorState::SAppListApp::SAppListApp(const std::string_view& clazz, const std::string_view& title) {
+CMonitorState::SAppListApp::SAppListApp(uint64_t id, const std::string_view& clazz, const std::string_view& title) : m_id(id), m_className(clazz) {
     m_null = Hyprtoolkit::CNullBuilder::begin()->size({Hyprtoolkit::CDynamicSize::HT_SIZE_PERCENT, Hyprtoolkit::CDynamicSize::HT_SIZE_AUTO, {1.F, 1.F}})->commence();
     m_null->setMargin(4);
     m_layout =
@@ -62,7 +81,7 @@ CMonitorState::SAppListApp::SAppListApp(const std::string_view& clazz, const std
                   ->commence();
 
     m_class = Hyprtoolkit::CTextBuilder::begin()
-                  ->text(std::string{clazz})
+                  ->text(classText(clazz, false))
                   ->color([] { return g_ui->backend()->getPalette()->m_colors.text; })
                   ->fontSize(Hyprtoolkit::CFontSize{Hyprtoolkit::CFontSize::HT_FONT_H3})
                   ->commence();
@@ -87,6 +106,14 @@ CMonitorState::SAppListApp::SAppListApp(const std::string_view& clazz, const std
     m_null->addChild(m_layout);
 }
 
+void CMonitorState::SAppListApp::setStuck(bool stuck) {
+    if (m_stuck == stuck)
+        return;
+
+    m_stuck = stuck;
+    m_class->rebuild()->text(classText(m_className, stuck))->commence();
+}
+
 CMonitorState::CMonitorState(SP<Hyprtoolkit::IOutput> output) : m_monitorName(output->port()) {
     m_window = Hyprtoolkit::CWindowBuilder::begin()
                    ->type(Hyprtoolkit::HT_WINDOW_LAYER)
@@ -121,7 +148,7 @@ CMonitorState::CMonitorState(SP<Hyprtoolkit::IOutput> output) : m_monitorName(ou
                     ->commence();
 
     m_subText = Hyprtoolkit::CTextBuilder::begin()
-                    ->text("Waiting for your apps to exit.\n<i>You can force quit Hyprland, but that risks losing unsaved progress.</i>")
+                    ->text(subText(std::nullopt))
                     ->color([] { return g_ui->backend()->getPalette()->m_colors.text; })
                     ->fontSize(Hyprtoolkit::CFontSize{Hyprtoolkit::CFontSize::HT_FONT_TEXT})
                     ->commence();
@@ -156,15 +183,9 @@ CMonitorState::CMonitorState(SP<Hyprtoolkit::IOutput> output) : m_monitorName(ou
 
     m_buttonLayout->addChild(spacer3);
 
-    m_forceQuit = makeButton(
-        "Force quit",
-        [](auto) {
-            State::state()->killAllApps();
-            g_ui->exit(true);
-        },
-        8.F);
+    m_forceQuit = makeButton("Force quit", [](auto) { g_shutdown->forceQuit(); }, 8.F);
 
-    m_cancel = makeButton("Cancel", [](auto) { g_ui->exit(false); }, 8.F);
+    m_cancel = makeButton("Cancel", [](auto) { g_shutdown->cancel(); }, 8.F);
 
     m_buttonLayout->addChild(m_cancel);
     m_buttonLayout->addChild(m_forceQuit);
@@ -191,15 +212,54 @@ CMonitorState::CMonitorState(SP<Hyprtoolkit::IOutput> output) : m_monitorName(ou
 }
 
 void CMonitorState::update() {
-    m_apps.clear();
-    m_appListLayout->clearChildren();
+    CTraceSpan  span("ui update", "ui");
 
     const auto& APPS = State::state()->apps();
 
+    // rows and apps are both in creation order, so one pass finds the rows of apps that are gone
+    size_t appIdx = 0;
+    std::erase_if(m_apps, [this, &APPS, &appIdx](const auto& row) {
+        while (appIdx < APPS.size() && APPS[appIdx]->m_id < row->m_id) {
+            ++appIdx;
+        }
+
+        if (appIdx < APPS.size() && APPS[appIdx]->m_id == row->m_id) {
+            row->setStuck(APPS[appIdx]->m_stuck);
+            ++appIdx;
+            return false;
+        }
+
+        m_appListLayout->removeChild(row->m_null);
+        return true;
+    });
+
+    // and anything newer than the last row is new
+    const auto LAST_ID = m_apps.empty() ? 0 : m_apps.back()->m_id;
+
     for (const auto& APP : APPS) {
-        m_apps.emplace_back(makeUnique<SAppListApp>(APP->m_class, APP->m_title));
+        if (APP->m_id <= LAST_ID)
+            continue;
+
+        m_apps.emplace_back(makeUnique<SAppListApp>(APP->m_id, APP->m_class, APP->m_title));
+        m_apps.back()->setStuck(APP->m_stuck);
         m_appListLayout->addChild(m_apps.back()->m_null);
     }
+
+    updateEta();
+
+    span.setCount(sc<int64_t>(m_apps.size()));
+}
+
+void CMonitorState::updateEta() {
+    // only rebuilt when the whole seconds change
+    const auto LEFT    = State::state()->secondsLeft();
+    const int  SECONDS = LEFT ? sc<int>(std::ceil(*LEFT)) : -1;
+
+    if (SECONDS == m_secondsLeftShown)
+        return;
+
+    m_secondsLeftShown = SECONDS;
+    m_subText->rebuild()->text(subText(LEFT))->commence();
 }
 
 void CUI::registerOutput(const SP<Hyprtoolkit::IOutput>& mon) {
@@ -207,87 +267,168 @@ void CUI::registerOutput(const SP<Hyprtoolkit::IOutput>& mon) {
     mon->m_events.removed.listenStatic([this, m = WP<Hyprtoolkit::IOutput>{mon}] { std::erase_if(m_states, [&m](const auto& e) { return e->m_monitorName == m->port(); }); });
 }
 
-void CUI::exit(bool closeHl) {
+void CUI::exit() {
+    if (g_ui->m_etaTimer)
+        g_ui->m_etaTimer->cancel();
+
     g_ui->m_states.clear();
 
-    g_ui->backend()->addIdle([this, closeHl] {
+    g_ui->backend()->addIdle([] {
         g_ui->m_backend->destroy();
         g_ui->m_backend.reset();
 
-        if (closeHl && !m_noExit && !State::state()->m_dryRun) {
-            //NOLINTNEXTLINE
-            std::string cmd = State::state()->m_useLua ? "/dispatch hl.dsp.exit()" : "/dispatch exit";
-            HyprlandIPC::getFromSocket(cmd);
-            if (m_postExitCmd) {
-                CProcess proc("/bin/sh", {"-c", m_postExitCmd.value()});
-                proc.runAsync();
-            }
+        // the overlay is gone by now, run() waits for this
+        g_shutdown->exitCompositor();
+    });
+}
+
+bool CUI::run() {
+    m_listeners.finished = g_shutdown->m_events.finished.listen([this] {
+        if (m_backend) {
+            exit();
+            return;
         }
+
+        // still waiting for the overlay, see waitForOverlay()
+        g_loop->leaveLoop();
+        g_shutdown->exitCompositor();
     });
+
+    g_shutdown->start();
+
+    if (!waitForOverlay()) {
+        // everything was gone before the overlay was due, no need to bring up a backend
+        g_logger->log(LOG_DEBUG, "Shutdown finished within {}ms, skipping the UI", m_overlayDelay.count());
+        g_shutdown->wait();
+        return true;
+    }
+
+    if (!initBackend())
+        return false;
+
+    showOverlay();
+
+    m_backend->enterLoop();
+
+    g_shutdown->wait();
+
+    return true;
 }
 
-void CUI::setTimer() {
-    // every 5 seconds or so, attempt to sigterm apps again
-    static uint16_t          counter     = 0;
-    constexpr const uint16_t COUNTER_MAX = 30;
-
-    m_updateTimer = m_backend->addTimer(
-        std::chrono::milliseconds(150),
-        [this](ASP<Hyprtoolkit::CTimer> timer, void* d) {
-            if (State::state()->apps().empty()) {
-                exit(true);
-                return;
-            }
-
-            counter++;
-
-            if (counter > COUNTER_MAX) {
-                g_logger->log(LOG_DEBUG, "Re-closing apps");
-                counter = 0;
-                State::state()->reexitApps();
-            }
-
-            if (!State::state()->updateState()) {
-                setTimer();
-                return; // no changes
-            }
-
-            for (const auto& s : m_states) {
-                s->update();
-            }
-
-            setTimer();
-        },
-        nullptr);
+bool CUI::runResident() {
+    if (!initBackend())
+        return false;
+
+    m_listeners.finished  = g_shutdown->m_events.finished.listen([this] { exit(); });
+    m_listeners.triggered = g_daemon->m_events.triggered.listen([this] {
+        g_shutdown->start();
+
+        if (m_overlayDelay.count() <= 0) {
+            showOverlay();
+            return;
+        }
+
+        // like waitForOverlay(), but the backend's loop is the one running
+        m_overlayTimer      = g_loop->addTimer(m_overlayDelay, [this] { showOverlay(); });
+        m_listeners.blocked = State::state()->m_events.changed.listen([this] {
+            if (State::state()->blocked())
+                showOverlay();
+        });
+    });
+
+    m_backend->enterLoop();
+
+    g_shutdown->wait();
+
+    return true;
 }
 
-bool CUI::run() {
+bool CUI::initBackend() {
     auto data           = Hyprtoolkit::IBackend::SBackendCreationData();
     data.pLogConnection = makeShared<Hyprutils::CLI::CLoggerConnection>(*g_logger);
     data.pLogConnection->setName("hyprtoolkit");
     data.pLogConnection->setLogLevel(LOG_DEBUG);
-    m_backend = Hyprtoolkit::IBackend::createWithData(data);
+    {
+        CTraceSpan span("ui backend", "ui");
+        m_backend = Hyprtoolkit::IBackend::createWithData(data);
+    }
 
     if (!m_backend)
         return false;
 
-    {
-        const auto MONITORS = m_backend->getOutputs();
+    m_listeners.newMon = m_backend->m_events.outputAdded.listen([this](SP<Hyprtoolkit::IOutput> mon) {
+        if (m_overlayShown)
+            registerOutput(mon);
+    });
+
+    // IPC, pidfds and compositor events all live on g_loop
+    m_backend->addFd(g_loop->fd(), [] { g_loop->dispatch(); });
 
-        for (const auto& m : MONITORS) {
-            registerOutput(m);
+    m_listeners.stateChanged = State::state()->m_events.changed.listen([this] {
+        for (const auto& s : m_states) {
+            s->update();
         }
+    });
 
-        m_listeners.newMon = m_backend->m_events.outputAdded.listen([this](SP<Hyprtoolkit::IOutput> mon) { registerOutput(mon); });
+    return true;
+}
 
-        g_logger->log(LOG_DEBUG, "Found {} output(s)", MONITORS.size());
+void CUI::showOverlay() {
+    if (m_overlayShown || g_shutdown->finished())
+        return;
 
-        setTimer();
+    m_overlayShown = true;
+
+    if (m_overlayTimer)
+        m_overlayTimer->cancel();
+
+    CTraceSpan span("ui outputs", "ui");
+    const auto MONITORS = m_backend->getOutputs();
+
+    for (const auto& m : MONITORS) {
+        registerOutput(m);
     }
 
-    m_backend->enterLoop();
+    g_logger->log(LOG_DEBUG, "Found {} output(s)", MONITORS.size());
 
-    return true;
+    scheduleEtaRefresh();
+}
+
+void CUI::scheduleEtaRefresh() {
+    // the countdown has to move while nothing else does
+    m_etaTimer = g_loop->addTimer(kEtaInterval, [this] {
+        for (const auto& s : m_states) {
+            s->updateEta();
+        }
+
+        scheduleEtaRefresh();
+    });
+}
+
+bool CUI::waitForOverlay() {
+    if (m_overlayDelay.count() <= 0)
+        return true;
+
+    bool       due      = false;
+    const auto TIMER    = g_loop->addTimer(m_overlayDelay, [&due] {
+        due = true;
+        g_loop->leaveLoop();
+    });
+    auto       listener = State::state()->m_events.changed.listen([&due] {
+        if (!State::state()->blocked())
+            return;
+
+        due = true;
+        g_loop->leaveLoop();
+    });
+
+    while (!due && !g_shutdown->finished()) {
+        g_loop->enterLoop();
+    }
+
+    TIMER->cancel();
+
+    return !g_shutdown->finished();
 }
 
 SP<Hyprtoolkit::IBackend> CUI::backend() {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <vector>
 
 #include <hyprtoolkit/core/Backend.hpp>
@@ -15,6 +16,7 @@
 
 #include <hyprutils/signal/Listener.hpp>
 
+#include "../helpers/EventLoop.hpp"
 #include "../helpers/Memory.hpp"
 
 class CMonitorState {
@@ -27,6 +29,8 @@ class CMonitorState {
     CMonitorState(CMonitorState&&)      = delete;
 
     void        update();
+    // the time left in m_subText
+    void        updateEta();
 
     std::string m_monitorName;
 
@@ -47,15 +51,25 @@ class CMonitorState {
     SP<Hyprtoolkit::CScrollAreaElement>   m_appListScroll;
     SP<Hyprtoolkit::CColumnLayoutElement> m_appListLayout;
 
+    // whole seconds of the ETA in m_subText, -1 if there is none
+    int                                   m_secondsLeftShown = -1;
+
     struct SAppListApp {
-        SAppListApp(const std::string_view& clazz, const std::string_view& title);
+        SAppListApp(uint64_t id, const std::string_view& clazz, const std::string_view& title);
+
+        void                                  setStuck(bool stuck);
 
+        // State::CApp::m_id of the app this row shows
+        uint64_t                              m_id = 0;
         SP<Hyprtoolkit::CNullElement>         m_null, m_titleNull, m_classNull;
         SP<Hyprtoolkit::CColumnLayoutElement> m_layout;
         SP<Hyprtoolkit::CTextElement>         m_title;
         SP<Hyprtoolkit::CTextElement>         m_class;
+        std::string                           m_className;
+        bool                                  m_stuck = false;
     };
 
+    // same order as State::state()->apps()
     std::vector<UP<SAppListApp>> m_apps;
 };
 
@@ -65,25 +79,37 @@ class CUI {
     ~CUI();
 
     bool                       run();
+    // --daemon: the backend comes up right away, the overlay once g_daemon is triggered
+    bool                       runResident();
     SP<Hyprtoolkit::IBackend>  backend();
 
-    bool                       m_noExit = false;
-    std::optional<std::string> m_postExitCmd;
     std::string                m_shutdownLabel;
+    // the overlay only comes up if apps are still open after this, or one is blocking
+    std::chrono::milliseconds  m_overlayDelay = std::chrono::milliseconds(300);
 
   private:
     void                           registerOutput(const SP<Hyprtoolkit::IOutput>& mon);
-    void                           setTimer();
-
-    void                           exit(bool closeHl = false);
+    // runs g_loop until the overlay is due. False if the shutdown finished before that.
+    bool                           waitForOverlay();
+    bool                           initBackend();
+    void                           showOverlay();
+    // takes the overlay down, then lets g_shutdown exit Hyprland
+    void                           exit();
+    void                           scheduleEtaRefresh();
 
     SP<Hyprtoolkit::IBackend>      m_backend;
-    ASP<Hyprtoolkit::CTimer>       m_updateTimer;
+    bool                           m_overlayShown = false;
+    SP<CEventLoopTimer>            m_overlayTimer;
+    SP<CEventLoopTimer>            m_etaTimer;
 
     std::vector<UP<CMonitorState>> m_states;
 
     struct {
         Hyprutils::Signal::CHyprSignalListener newMon;
+        Hyprutils::Signal::CHyprSignalListener stateChanged;
+        Hyprutils::Signal::CHyprSignalListener finished;
+        Hyprutils::Signal::CHyprSignalListener triggered;
+        Hyprutils::Signal::CHyprSignalListener blocked;
     } m_listeners;
 
     friend class CMonitorState;